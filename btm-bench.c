@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L /* for getopt() and clock_gettime() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btm.h"
+#include "seq.h"
+#include "util.h"
+
+#define NREPEAT 3
+#define NITER   20000000
+#define NTRACE  (3 << 12)
+
+/*
+ * long-running halters and the number of steps they take.
+ */
+static const struct {
+	const char *name;
+	const char *table;
+	long long nstep;
+} corpus[] = {
+	{ "bb3", "Ifi1Oi2i", 21 },
+	{ "bb4", "Ii1i0ofiI3O", 107 },
+	{ "bb5", "Ii2II1Io4i0i3fo", 47176870 },
+};
+
+static const char *enumpath = "./btm-enum";
+static int nrepeat = NREPEAT;
+
+static void
+usage(void)
+{
+	printf(
+"usage: %s [options]\n"
+"options:\n"
+"  -e path    run btm-enum from PATH. the default is ./btm-enum\n"
+"  -r repeat  take the best of REPEAT measurements. the default is 3\n"
+"  -h         show this help message and exit\n"
+"every line of the output has the name of a benchmark, a tab, the\n"
+"measured throughput, a tab and its unit.  the workloads are fixed, so\n"
+"the numbers can be compared between builds\n"
+	, progname);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report(const char *name, const char *arg, double rate, const char *unit)
+{
+	printf("%s%s%s\t%.0f\t%s\n", name, arg ? " " : "", arg ? arg : "", rate, unit);
+	fflush(stdout);
+}
+
+/*
+ * runs each halter of the corpus to completion, as many times as it
+ * takes to fill about a tenth of a second.
+ */
+static void
+benchrun(BTM *btm)
+{
+	double t, best;
+	long long n, m;
+	int i, k;
+
+	for (i = 0; i < sizeof(corpus) / sizeof(*corpus); ++i) {
+		if (btm_table_load(btm, corpus[i].table))
+			die("btm_table_load %s:", corpus[i].table);
+		best = 0;
+		for (k = 0; k < nrepeat; ++k) {
+			t = now();
+			n = 0;
+			do {
+				btm_reset(btm);
+				if ((m = btm_run(btm, corpus[i].nstep, NULL)) != corpus[i].nstep)
+					die("%s: Ran %lld steps instead of %lld", corpus[i].table,
+					m, corpus[i].nstep);
+				n += m;
+			} while (now() - t < 0.1);
+			best = MAX(best, n / (now() - t));
+		}
+		report("run", corpus[i].name, best, "steps/s");
+	}
+}
+
+/*
+ * iterates size-5 BTMs with every combination of the non-random flags.
+ */
+static void
+benchiter(void)
+{
+	static const char *const name[] = { "c", "e", "f", "u" };
+	static const int flag[] = { BTM_CYCLIC, BTM_NONERASING, BTM_EXCL_NO_FIN, BTM_EXCL_MULTI_FIN };
+	BTMIter *it;
+	char arg[8];
+	double t, best;
+	int comb, flags, n, i, k;
+
+	for (comb = 0; comb < 16; ++comb) {
+		for (i = n = flags = 0; i < 4; ++i) {
+			if (comb >> i & 1) {
+				n += sprintf(arg + n, "%s", name[i]);
+				flags |= flag[i];
+			}
+		}
+		if (!n)
+			strcpy(arg, "-");
+		best = 0;
+		for (k = 0; k < nrepeat; ++k) {
+			if (!(it = btm_iter_new(5, flags, "I", -1)))
+				die("btm_iter_new:");
+			t = now();
+			for (i = 0; i < NITER && btm_iter_deref(it); ++i)
+				btm_iter_incr(it);
+			best = MAX(best, i / (now() - t));
+			btm_iter_del(it);
+		}
+		report("iter", arg, best, "BTMs/s");
+	}
+}
+
+/*
+ * runs repeating() and dedup() the way btm-enum -z 4,12 -d 20 does, on
+ * the instructions recorded from the halters of the corpus that run
+ * long enough.
+ */
+static void
+benchseq(BTM *btm)
+{
+	int *steps, *copy;
+	double t, best, rbest, dbest;
+	long long nrep, ndedup;
+	int i, k, n, m;
+
+	if (!(steps = malloc(NTRACE * sizeof(*steps)))
+	|| !(copy = malloc((NTRACE + 20) * sizeof(*copy))))
+		die("malloc:");
+	rbest = dbest = 0;
+	for (i = 0; i < sizeof(corpus) / sizeof(*corpus); ++i) {
+		if (corpus[i].nstep < NTRACE)
+			continue;
+		btm_table_load(btm, corpus[i].table);
+		btm_reset(btm);
+		n = btm_run(btm, NTRACE, steps);
+		for (k = 0; k < nrepeat; ++k) {
+			t = now();
+			nrep = 0;
+			do {
+				for (m = 4; m * 3 <= n; m *= 2) {
+					repeating(steps + m, m * 2, 4);
+					nrep += m * 2;
+				}
+			} while (now() - t < 0.1);
+			best = nrep / (now() - t);
+			rbest = MAX(rbest, best);
+			t = now();
+			ndedup = 0;
+			do {
+				memcpy(copy, steps, n * sizeof(*steps));
+				m = n;
+				dedup(copy, &m, 20);
+				ndedup += n;
+			} while (now() - t < 0.1);
+			best = ndedup / (now() - t);
+			dbest = MAX(dbest, best);
+		}
+	}
+	report("repeating", NULL, rbest, "steps/s");
+	report("dedup", NULL, dbest, "steps/s");
+	free(steps);
+	free(copy);
+}
+
+/*
+ * runs btm-enum for all size-4 BTMs with typical filters.  the BTMs
+ * tried are the ones iterated from the prefixes btm-enum picks for
+ * these options, O and I.
+ */
+static void
+benchenum(void)
+{
+	static const char *const cmd = "%s -mfuas -t 10,1000 -z 2,8 -d 8 4 >/dev/null";
+	static const char *const prefix[] = { "O", "I" };
+	BTMIter *it;
+	char *buf;
+	double t, best;
+	long long ntry;
+	int i, k;
+
+	for (i = ntry = 0; i < 2; ++i) {
+		if (!(it = btm_iter_new(4, BTM_EXCL_NO_FIN|BTM_EXCL_MULTI_FIN, prefix[i], -1)))
+			die("btm_iter_new:");
+		for (; btm_iter_deref(it); btm_iter_incr(it))
+			++ntry;
+		btm_iter_del(it);
+	}
+	if (!(buf = malloc(strlen(cmd) + strlen(enumpath))))
+		die("malloc:");
+	sprintf(buf, cmd, enumpath);
+	best = 0;
+	for (k = 0; k < nrepeat; ++k) {
+		t = now();
+		if (system(buf))
+			die("%s: Failed", buf);
+		best = MAX(best, ntry / (now() - t));
+	}
+	report("enum", "4", best, "BTMs/s");
+	free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	BTM *btm;
+	int c;
+
+	progname = argv[0];
+	while ((c = getopt(argc, argv, ":e:r:h")) != -1) {
+		switch (c) {
+		case 'e':
+			enumpath = optarg;
+			break;
+		case 'r':
+			nrepeat = xatoi(optarg);
+			if (nrepeat < 1)
+				nrepeat = 1;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case ':':
+			die("Option -%c requires an operand", optopt);
+		default:
+			die("Unrecognized option: -%c", optopt);
+		}
+	}
+	if (argc > optind)
+		die("Too many arguments");
+	if (!(btm = btm_new()))
+		die("btm_new:");
+	benchrun(btm);
+	benchiter();
+	benchseq(btm);
+	benchenum();
+	btm_del(btm);
+	return 0;
+}
@@ -0,0 +1,133 @@
+#define _POSIX_C_SOURCE 200809L /* for getopt() and getline() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "btm.h"
+#include "util.h"
+
+static int tflag = 0;
+static BTM *btm;
+static char *buf;
+static int bufsize;
+
+static void
+usage(void)
+{
+	printf(
+"usage: %s [options]\n"
+"options:\n"
+"  -t  convert binary records to text instead of the other way around\n"
+"  -h  show this help message and exit\n"
+"reads from stdin BTMs as output by btm-enum (with or without -a) or by\n"
+"btm-emul -s and writes them to stdout as binary records, which is the\n"
+"format produced by the -B option of these programs, or vice versa.\n"
+"records of BTM prefixes (btm-enum -l) can only be converted to text\n"
+	, progname);
+}
+
+static void
+totext(void)
+{
+	long long nstep;
+	int len, kind, n, r;
+
+	while ((r = btm_rec_read(btm, &len, &kind, &nstep, stdin)) > 0) {
+		while ((n = btm_table_dump_into(btm, buf, bufsize)) >= bufsize)
+			if (!(buf = realloc(buf, bufsize = n + 1)))
+				die("realloc:");
+		if (n < 0)
+			die("btm_table_dump_into:");
+		buf[n + len - btm_get_size(btm) * 2] = '\0';
+		switch (kind) {
+		case BTM_REC_NONE:
+			puts(buf);
+			break;
+		case BTM_REC_STEPS:
+			printf("%s\t%lld\n", buf, nstep);
+			break;
+		case BTM_REC_FINISHED:
+			printf("%s finished in %lld steps\n", buf, nstep);
+			break;
+		case BTM_REC_CONTINUES:
+			printf("%s continues after %lld steps\n", buf, nstep);
+			break;
+		}
+	}
+	if (r < 0)
+		die("btm_rec_read:");
+}
+
+static void
+tobinary(void)
+{
+	char *p, *q;
+	size_t l;
+	ssize_t n;
+	long long nstep;
+	int kind, k;
+
+	p = NULL;
+	while ((n = getline(&p, &l, stdin)) != -1) {
+		if (n && p[n - 1] == '\n')
+			p[--n] = '\0';
+		if (!p[strspn(p, " \t")])
+			continue;
+		kind = BTM_REC_NONE;
+		nstep = 0;
+		if ((q = strpbrk(p, " \t"))) {
+			if (*q == '\t') {
+				kind = BTM_REC_STEPS;
+				nstep = xatoll(q + 1);
+			} else if (sscanf(q, " finished in %lld steps%n", &nstep, &k) == 1 && !q[k]) {
+				kind = BTM_REC_FINISHED;
+			} else if (sscanf(q, " continues after %lld steps%n", &nstep, &k) == 1 && !q[k]) {
+				kind = BTM_REC_CONTINUES;
+			} else {
+				die("%s: Unrecognized line", p);
+			}
+			*q = '\0';
+		}
+		if (btm_table_load(btm, p))
+			die("btm_table_load %s:", p);
+		if (btm_rec_write(btm, -1, kind, nstep, stdout))
+			die("btm_rec_write:");
+	}
+	if (ferror(stdin))
+		die("getline:");
+	free(p);
+}
+
+int
+main(int argc, char **argv)
+{
+	int c;
+
+	progname = argv[0];
+	while ((c = getopt(argc, argv, ":th")) != -1) {
+		switch (c) {
+		case 't':
+			tflag = 1;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		default:
+			die("Unrecognized option: -%c", optopt);
+		}
+	}
+	if (argc > optind)
+		die("Too many arguments");
+	if (!(btm = btm_new()))
+		die("btm_new:");
+	if (tflag)
+		totext();
+	else
+		tobinary();
+	if (fflush(stdout))
+		die("fflush:");
+	btm_del(btm);
+	free(buf);
+	return 0;
+}
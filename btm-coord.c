@@ -0,0 +1,422 @@
+#define _POSIX_C_SOURCE 200809L /* for getopt(), getline() and sigaction() */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "net.h"
+#include "util.h"
+
+enum { PENDING, RUNNING, DONE, FAILED };
+
+struct shard {
+	char *prefix;
+	int status;
+	int nfail;
+};
+
+struct worker {
+	int fd;
+	int shard;
+	time_t seen;
+	struct linebuf lb;
+	char *res;
+	size_t reslen;
+	size_t rescap;
+};
+
+static sig_atomic_t done = 0;
+static int timeout = 30;
+static int maxfail = 3;
+static char *args;
+static struct shard *shards;
+static int nshard, nleft;
+static struct worker *workers;
+static int nworker;
+static FILE *journal, *output;
+
+static void
+usage(void)
+{
+	printf(
+"usage: %s [options] journal output address [--] [btm-enum-arg]...\n"
+"options:\n"
+"  -T timeout  consider a worker lost if it has been silent for TIMEOUT\n"
+"              seconds. the default is 30\n"
+"  -r retry    give up a shard after btm-enum fails on it RETRY times. the\n"
+"              default is 3\n"
+"  -h          show this help message and exit\n"
+"shards (btm-enum prefixes) are read from stdin, one per line. ADDRESS is\n"
+"either a path of a Unix domain socket or host:port for TCP. results of\n"
+"finished shards are appended to OUTPUT and recorded in JOURNAL, so that a\n"
+"restarted campaign resumes where it left off\n"
+	, progname);
+}
+
+static void
+setdone(int sig)
+{
+	done = 1;
+}
+
+static void
+loadshards(void)
+{
+	char *p;
+	size_t l;
+	ssize_t n;
+	int cap;
+
+	p = NULL;
+	cap = 0;
+	while ((n = getline(&p, &l, stdin)) != -1) {
+		if (n && p[n - 1] == '\n')
+			p[--n] = '\0';
+		if (!p[strspn(p, " \t")])
+			continue;
+		if (nshard == cap) {
+			cap = cap ? cap * 2 : 64;
+			if (!(shards = realloc(shards, cap * sizeof(*shards))))
+				die("realloc:");
+		}
+		if (!(shards[nshard].prefix = strdup(p + strspn(p, " \t"))))
+			die("strdup:");
+		shards[nshard].status = PENDING;
+		shards[nshard].nfail = 0;
+		++nshard;
+	}
+	if (ferror(stdin))
+		die("getline:");
+	free(p);
+	nleft = nshard;
+}
+
+/*
+ * the journal starts with the btm-enum arguments of the campaign and
+ * has a "done PREFIX OFFSET" line for every finished shard, OFFSET being
+ * the size of the output after the shard's results were appended.
+ * output beyond the last recorded offset belongs to a shard that wasn't
+ * committed, so it's truncated.  so is a last line without a newline,
+ * cut off by a crash while it was written: its shard isn't done.
+ * without a journal the output must be empty, lest a mistyped or lost
+ * journal wipe the results of a campaign.
+ */
+static void
+loadjournal(const char *jpath, const char *opath)
+{
+	FILE *fp;
+	char *p, *q;
+	size_t l;
+	ssize_t n;
+	long off, good;
+	int i, loaded;
+
+	off = good = loaded = 0;
+	if ((fp = fopen(jpath, "r"))) {
+		loaded = 1;
+		p = NULL;
+		if ((n = getline(&p, &l, fp)) != -1 && p[n - 1] == '\n') {
+			p[--n] = '\0';
+			if (strncmp(p, "args ", 5) || strcmp(p + 5, args))
+				die("%s: Journal of a campaign with different arguments", jpath);
+			good = ftell(fp);
+		}
+		while (good && (n = getline(&p, &l, fp)) != -1 && p[n - 1] == '\n') {
+			p[--n] = '\0';
+			q = strrchr(p, ' ');
+			if (strncmp(p, "done ", 5) || q == p + 4)
+				die("%s: Invalid journal entry: `%s'", jpath, p);
+			*q++ = '\0';
+			off = atol(q);
+			for (i = 0; i < nshard; ++i) {
+				if (shards[i].status == PENDING && !strcmp(shards[i].prefix, p + 5)) {
+					shards[i].status = DONE;
+					--nleft;
+				}
+			}
+			good = ftell(fp);
+		}
+		if (ferror(fp))
+			die("getline:");
+		free(p);
+		fclose(fp);
+		if (truncate(jpath, good))
+			die("truncate %s:", jpath);
+	} else if (errno != ENOENT) {
+		die("fopen %s:", jpath);
+	}
+	if (!(journal = fopen(jpath, "a")))
+		die("fopen %s:", jpath);
+	if (!ftell(journal)) {
+		fprintf(journal, "args %s\n", args);
+		if (fflush(journal) || fsync(fileno(journal)))
+			die("%s:", jpath);
+	}
+	if (!(output = fopen(opath, "a")))
+		die("fopen %s:", opath);
+	if (!loaded && ftell(output))
+		die("%s: Output of a campaign without journal %s", opath, jpath);
+	if (ftruncate(fileno(output), off))
+		die("ftruncate %s:", opath);
+}
+
+static void
+commit(struct worker *w)
+{
+	struct shard *s;
+
+	s = &shards[w->shard];
+	if (fwrite(w->res, 1, w->reslen, output) != w->reslen
+	|| fflush(output) || fsync(fileno(output)))
+		die("write output:");
+	fprintf(journal, "done %s %ld\n", s->prefix, ftell(output));
+	if (fflush(journal) || fsync(fileno(journal)))
+		die("write journal:");
+	s->status = DONE;
+	--nleft;
+	w->shard = -1;
+	w->reslen = 0;
+}
+
+static void
+release(struct worker *w, int failed)
+{
+	struct shard *s;
+
+	if (w->shard < 0)
+		return;
+	s = &shards[w->shard];
+	s->status = PENDING;
+	if (failed && ++s->nfail >= maxfail) {
+		warn("%s: Giving up after %d failures", s->prefix, s->nfail);
+		s->status = FAILED;
+		--nleft;
+	}
+	w->shard = -1;
+	w->reslen = 0;
+}
+
+static void
+drop(int i)
+{
+	release(&workers[i], 0);
+	close(workers[i].fd);
+	lbfree(&workers[i].lb);
+	free(workers[i].res);
+	workers[i] = workers[--nworker];
+}
+
+static int
+assign(struct worker *w)
+{
+	int i, running;
+
+	running = 0;
+	for (i = 0; i < nshard; ++i) {
+		if (shards[i].status == PENDING) {
+			shards[i].status = RUNNING;
+			w->shard = i;
+			return netsend(w->fd, "shard %d %s\n", i, shards[i].prefix);
+		}
+		running |= shards[i].status == RUNNING;
+	}
+	return netsend(w->fd, running ? "wait\n" : "done\n");
+}
+
+static int
+append(struct worker *w, const char *str)
+{
+	size_t l, cap;
+	char *p;
+
+	l = strlen(str);
+	if (w->reslen + l + 1 > w->rescap) {
+		cap = MAX(w->rescap * 2, w->reslen + l + 1);
+		if (!(p = realloc(w->res, cap)))
+			return -1;
+		w->res = p;
+		w->rescap = cap;
+	}
+	memcpy(w->res + w->reslen, str, l);
+	w->res[w->reslen + l] = '\n';
+	w->reslen += l + 1;
+	return 0;
+}
+
+/*
+ * handles a message from worker @w.  returns non-zero if the worker
+ * has to be dropped for a protocol violation or a failure to reply.
+ */
+static int
+handle(struct worker *w, char *msg)
+{
+	char *p;
+	int id;
+
+	w->seen = time(NULL);
+	if (!strcmp(msg, "beat"))
+		return 0;
+	if (!strcmp(msg, "next"))
+		return w->shard >= 0 || assign(w);
+	if (!(p = strchr(msg, ' ')))
+		return -1;
+	*p++ = '\0';
+	id = strtol(p, &p, 10);
+	if (id != w->shard || (*p && *p++ != ' '))
+		return -1;
+	if (!strcmp(msg, "result"))
+		return append(w, p);
+	if (!strcmp(msg, "end")) {
+		commit(w);
+		return 0;
+	}
+	if (!strcmp(msg, "fail")) {
+		warn("%s: btm-enum failed: %s", shards[id].prefix, p);
+		release(w, 1);
+		return 0;
+	}
+	return -1;
+}
+
+/*
+ * once every shard is finished or given up, no more workers are taken
+ * in and the rest are answered "done" until they hang up, so none of
+ * them finds the connection closed under it.
+ */
+static void
+serve(int lfd)
+{
+	struct pollfd *pfds;
+	char *msg;
+	time_t now;
+	int i, fd, n;
+
+	pfds = NULL;
+	while (!done && (nleft || nworker)) {
+		if (!(pfds = realloc(pfds, (nworker + 1) * sizeof(*pfds))))
+			die("realloc:");
+		pfds[0].fd = nleft ? lfd : -1;
+		pfds[0].events = POLLIN;
+		for (i = 0; i < nworker; ++i) {
+			pfds[i + 1].fd = workers[i].fd;
+			pfds[i + 1].events = POLLIN;
+		}
+		if ((n = poll(pfds, nworker + 1, 1000)) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("poll:");
+		}
+		now = time(NULL);
+		for (i = nworker; i--;) {
+			if (pfds[i + 1].revents) {
+				if (lbfill(&workers[i].lb, workers[i].fd) <= 0) {
+					drop(i);
+					continue;
+				}
+				while ((msg = lbline(&workers[i].lb)) && !handle(&workers[i], msg))
+					;
+				if (msg) {
+					warn("Dropping worker sending `%s'", msg);
+					drop(i);
+					continue;
+				}
+			}
+			if (now - workers[i].seen > timeout) {
+				warn("Dropping worker silent for %lds", (long)(now - workers[i].seen));
+				drop(i);
+			}
+		}
+		if (pfds[0].revents && (fd = accept(lfd, NULL, NULL)) >= 0) {
+			if (!(workers = realloc(workers, (nworker + 1) * sizeof(*workers))))
+				die("realloc:");
+			memset(&workers[nworker], 0, sizeof(*workers));
+			workers[nworker].fd = fd;
+			workers[nworker].shard = -1;
+			workers[nworker].seen = now;
+			if (netsend(fd, "args %s\n", args))
+				close(fd);
+			else
+				++nworker;
+		}
+	}
+	free(pfds);
+	while (nworker)
+		drop(nworker - 1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sa;
+	size_t l;
+	int c, i, lfd;
+
+	progname = argv[0];
+	while ((c = getopt(argc, argv, ":T:r:h")) != -1) {
+		switch (c) {
+		case 'T':
+			timeout = xatoi(optarg);
+			break;
+		case 'r':
+			maxfail = xatoi(optarg);
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case ':':
+			die("Option -%c requires an operand", optopt);
+		default:
+			die("Unrecognized option: -%c", optopt);
+		}
+	}
+	if (argc - optind < 3)
+		die("Missing argument");
+	i = optind + 3;
+	if (i < argc && !strcmp(argv[i], "--"))
+		++i;
+	for (c = i, l = 1; c < argc; ++c)
+		l += strlen(argv[c]) + 1;
+	if (!(args = malloc(l)))
+		die("malloc:");
+	args[0] = '\0';
+	for (c = i; c < argc; ++c) {
+		if (strchr(argv[c], '\t') || strchr(argv[c], '\n'))
+			die("%s: Tabs and newlines are not allowed in arguments", argv[c]);
+		if (c > i)
+			strcat(args, "\t");
+		strcat(args, argv[c]);
+	}
+	loadshards();
+	loadjournal(argv[optind], argv[optind + 1]);
+	if ((lfd = netlisten(argv[optind + 2])) < 0)
+		die("listen %s:", argv[optind + 2]);
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = setdone;
+	if (sigaction(SIGTERM, &sa, NULL)
+	|| sigaction(SIGINT, &sa, NULL))
+		die("sigaction:");
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL))
+		die("sigaction:");
+	serve(lfd);
+	close(lfd);
+	if (strchr(argv[optind + 2], '/'))
+		unlink(argv[optind + 2]);
+	fclose(journal);
+	fclose(output);
+	c = done || nleft;
+	for (i = 0; i < nshard; ++i) {
+		c |= shards[i].status == FAILED;
+		free(shards[i].prefix);
+	}
+	free(shards);
+	free(workers);
+	free(args);
+	return c;
+}
@@ -1,19 +1,99 @@
-#define _POSIX_C_SOURCE 200809L /* for getopt() and getline() */
+#define _POSIX_C_SOURCE 200809L /* for getopt(), getline() and sigaction() */
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "btm.h"
+#include "decide.h"
+#include "specs.h"
 #include "util.h"
 
+#define RUN_CHUNK (1LL << 24)
+#define DELTA_CHUNK 4096
+
+/*
+ * with -i, a BTM gets at least ID_MINSTEP steps at a time, of which at
+ * most a quarter, up to CY_MAXSTEP, goes to cycler() and as much, up to
+ * TC_MAXSTEP, to tcycler().
+ */
+#define ID_MINSTEP (1LL << 10)
+#define CY_MAXSTEP (1LL << 20)
+#define TC_MAXSTEP (1LL << 16)
+
+static sig_atomic_t done = 0;
 static long long nstep = 50;
 static long long start = 0;
-static int sflag = 0, cflag = 0;
+static int sflag = 0, cflag = 0, Bflag = 0, dflag = 0, rflag = 0, iflag = 0;
+static long long kstep = 1;
+static int nthread = 1;
+static int maxcols = 1024, maxrows = 1024;
+static FILE *diagfp;
 static BTM *btm;
 
+/*
+ * with -M, the tape of every BTM is limited to @memlimit bytes, and
+ * @peak is the most memory a BTM has held.  @full is set once the BTM
+ * of the main thread reaches the limit.
+ */
+static int Mflag = 0;
+static size_t memlimit = 0;
+static size_t peak = 0;
+static int full;
+
+/*
+ * a row of a space-time diagram: the written range of the tape at a
+ * sampled step, one bit per cell.
+ */
+struct row {
+	int start;
+	int len;
+	unsigned char *bits;
+};
+
+static struct row *rows;
+static int nrow;
+
+/*
+ * an unfinished BTM of a btm-cont state file, with specs @line, that
+ * has run @base steps.  the file gives it a step count of its own if
+ * @own is set and the step count of the file otherwise.  after the
+ * round, @line is replaced by its summary if it finished in @nstep
+ * steps or was proved by the decider @verdict never to finish, or by
+ * its updated specs otherwise.  @full is set if it reached the memory
+ * limit and @invalid if its instruction table is invalid, either of
+ * which keeps it from running again in the round.  an invalid holdout's
+ * line is kept as it is.
+ */
+struct holdout {
+	char *line;
+	long long base;
+	long long nstep;
+	const char *verdict;
+	int own;
+	int full;
+	int invalid;
+};
+
+static struct holdout *holdouts;
+static int nholdout, nexthold;
+static pthread_mutex_t holdlock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * with -i, the holdouts waiting to run are kept in a heap ordered by
+ * @base, @nbusy are running and @left steps remain for the round.
+ */
+static int *heap;
+static int nheap, nbusy;
+static long long left;
+static pthread_cond_t holdcond = PTHREAD_COND_INITIALIZER;
+
 static void
 usage(void)
 {
@@ -21,85 +101,306 @@ usage(void)
 "usage: %s [options] [btm-spec]...\n"
 "options:\n"
 "  -s        only summarize the emulation\n"
+"  -B        with -s, output binary records instead of text (see btm-conv)\n"
 "  -c        for every BTM that didn't finish, append to its summary a colon\n"
 "            followed by the BTM's specs after the last step\n"
+"  -d        trace only the changes: after the initial configuration, a\n"
+"            line per step gives the head position, the symbol written,\n"
+"            the move and the new state (or f for FIN), and the final\n"
+"            configuration follows\n"
+"  -k k      trace only every K-th step\n"
+"  -r        trace only the steps where the head enters a new cell\n"
+"  -g file   instead of tracing, append to FILE a space-time diagram of\n"
+"            every BTM as a PGM image, with darker pixels for more 1s\n"
+"  -z cols,rows\n"
+"            with -g, downsample the diagrams to at most COLS by ROWS\n"
+"            pixels. the default is 1024,1024\n"
 "  -n nstep  if NSTEP is positive, it sets the maximum number of steps,\n"
 "            otherwise there is no limit. the default is 50\n"
 "  -b start  START indicates the number of steps the BTMs have already run\n"
+"  -u file   continue the unfinished BTMs in btm-cont state file FILE for\n"
+"            NSTEP more steps, print the newly finished ones and update FILE\n"
+"  -i        with -u, schedule by iterative deepening instead: the BTM that\n"
+"            has run the fewest steps goes next and runs as many steps again,\n"
+"            first trying to prove that it never finishes, until NSTEP steps\n"
+"            per BTM have been run in total\n"
+"  -j nthread\n"
+"            with -u, run NTHREAD threads, and parse a regular file on stdin\n"
+"            with as many. the default is 1\n"
+"  -M bytes  limit the tape of every BTM to BYTES bytes, 0 for no limit. a\n"
+"            BTM reaching the limit stops and is reported on stderr, its\n"
+"            specs kept as if it hadn't finished in NSTEP steps. the most\n"
+"            memory a BTM held is reported at exit\n"
 "  -h        show this help message and exit\n"
-"BTM specs are read from stdin if none is given in the command line\n"
+"BTM specs are read from stdin if none is given in the command line. a line\n"
+"of the form \"TABLE continues after N steps: SPECS\", as -c writes it,\n"
+"continues the BTM from step N\n"
 	, progname);
 }
 
 static void
-putconf(BTM *btm)
+setdone(int sig)
 {
-	int i, j, k, h;
+	done = 1;
+}
 
-	btm_get_range(btm, &i, &j);
-	h = btm_get_head(btm);
-	if (h < i)
-		i = h;
-	else if (h >= j)
-		j = h + 1;
-	for (k = i; k < j; ++k) {
-		putchar(btm_get_cell(btm, k));
-		if (k == h)
-			printf("(%d)", btm_get_state(btm));
-	}
-	putchar('\n');
+/*
+ * formats @btm's configuration into the growable buffer pointed to by
+ * @buf, whose size is pointed to by @size, and returns the buffer.
+ */
+static char *
+dumpconf(const BTM *btm, char **buf, size_t *size)
+{
+	int n;
+
+	while ((n = btm_conf_dump_into(btm, *buf, *size)) >= *size)
+		if (!(*buf = realloc(*buf, *size = n + 1)))
+			die("realloc:");
+	return *buf;
 }
 
 static void
-handle(char *str)
+putconf(const BTM *btm)
 {
-	char *conf, *p, *q;
-	long long n;
+	static char *buf;
+	static size_t size;
+
+	puts(dumpconf(btm, &buf, &size));
+}
+
+/*
+ * loads the BTM specified by @str, an instruction table optionally
+ * followed by a comma and a configuration, into @btm.  @str is cut
+ * after the instruction table.  returns non-zero value if the
+ * instruction table is invalid.
+ */
+static int
+load(BTM *btm, char *str)
+{
+	char *conf;
 
 	if ((conf = strchr(str, ',')))
 		*conf++ = '\0';
-	if (btm_table_load(btm, str)) {
-		warn("btm_table_load %s:", str);
-		return;
-	}
+	if (btm_table_load(btm, str))
+		return -1;
 	btm_reset(btm);
-	if (conf) {
-		p = conf + strspn(conf, " \t");
-		n = strspn(p, "01");
-		if (btm_set_tape(btm, -n + 1, 1, p))
-			die("btm_set_tape:");
-		p += n;
-		p += strspn(p, " \t");
-		if (*p != '(' || !(q = strchr(p + 1, ')')))
-			die("%s: Invalid configuration", conf);
-		*q = '\0';
-		if (btm_set_state(btm, xatoi(p + 1)))
-			die("btm_set_state:");
-		*q++ = ')';
-		p = q + strspn(q, " \t");
-		if ((n = strspn(p, "01"))) {
-			if (btm_set_tape(btm, 1, n + 1, p))
-				die("btm_set_tape:");
-			p += n;
-			p += strspn(p, " \t");
-		}
-		if (*p)
-			die("%s: Trailing characters: `%s'", conf, p);
+	if (conf && btm_conf_load(btm, conf))
+		die("btm_conf_load %s:", conf);
+	return 0;
+}
+
+/*
+ * returns @n, what a run of a BTM or a decider returned, or 0 if it
+ * failed because the tape reached the memory limit, setting the int
+ * pointed to by @full then.  other failures of @func are fatal.
+ */
+static long long
+checkfull(long long n, int *full, const char *func)
+{
+	if (n >= 0)
+		return n;
+	if (errno != ENOBUFS)
+		die("%s:", func);
+	*full = 1;
+	return 0;
+}
+
+/*
+ * runs @btm for at most @nstep steps and returns the number of steps
+ * executed.  the run is chunked so that a signal interrupts it in good
+ * time and stdout is flushed when due meanwhile.  it stops early and
+ * sets the int pointed to by @full if the tape reaches the memory limit.
+ */
+static long long
+advance(BTM *btm, long long nstep, int *full)
+{
+	long long n, m;
+
+	for (n = 0; n < nstep && btm_get_state(btm) >= 0 && !done && !*full; n += m) {
+		m = checkfull(btm_run(btm, MIN(nstep - n, RUN_CHUNK), NULL), full, "btm_run");
+		outtick();
 	}
-	if (sflag) {
-		n = btm_run(btm, nstep, NULL);
-		if (n < 0)
-			die("btm_run:");
-	} else {
-		printf("%s:\n", str);
-		for (n = 0; n < nstep && btm_get_state(btm) >= 0; ++n) {
+	return n;
+}
+
+/*
+ * prints the configurations of @btm at every @kstep-th step, or only
+ * when the head has moved beyond the written range of the tape if
+ * @rflag is set, and returns the number of steps executed.
+ */
+static long long
+trace(BTM *btm)
+{
+	long long n, m;
+	int ev, show;
+
+	for (n = 0, show = 1; n < nstep && btm_get_state(btm) >= 0 && !done && !full; n += m) {
+		if (show) {
 			printf("%lld: ", start + n);
 			putconf(btm);
-			if (btm_run(btm, 1, NULL) < 0)
-				die("btm_run:");
+			outtick();
+		}
+		if (!rflag) {
+			m = advance(btm, MIN(kstep, nstep - n), &full);
+			continue;
 		}
+		m = btm_run_until(btm, MIN(nstep - n, RUN_CHUNK), BTM_EV_LEFT|BTM_EV_RIGHT, 0, 0, &ev);
+		m = checkfull(m, &full, "btm_run_until");
+		show = ev;
 	}
-	if (btm_get_state(btm) < 0) {
+	return n;
+}
+
+static long long
+tracedelta(BTM *btm)
+{
+	static int steps[DELTA_CHUNK];
+	long long n, m, k;
+	int h, instr;
+
+	printf("%lld: ", start);
+	putconf(btm);
+	h = btm_get_head(btm);
+	for (n = 0; n < nstep && btm_get_state(btm) >= 0 && !done && !full; n += m) {
+		m = checkfull(btm_run(btm, MIN(DELTA_CHUNK, nstep - n), steps), &full, "btm_run");
+		for (k = 0; k < m; ++k) {
+			instr = steps[k];
+			if (instr == BTM_FIN) {
+				printf("%lld: %d f\n", start + n + k, h);
+				continue;
+			}
+			printf("%lld: %d %c%c %d\n", start + n + k, h, BTM_INSTR_S(instr),
+			BTM_INSTR_M(instr), BTM_INSTR_Q(instr));
+			h += instr & 1 ? 1 : -1;
+		}
+		outtick();
+	}
+	printf("%lld: ", start + n);
+	putconf(btm);
+	return n;
+}
+
+static void
+addrow(const BTM *btm)
+{
+	static int cap;
+	struct row *r;
+	int k;
+
+	if (nrow == cap && !(rows = realloc(rows, (cap = cap ? cap * 2 : 64) * sizeof(*rows))))
+		die("realloc:");
+	r = &rows[nrow++];
+	btm_get_range(btm, &r->start, &k);
+	r->len = k - r->start;
+	if (!(r->bits = malloc((r->len + 7) / 8 + 1)))
+		die("malloc:");
+	btm_get_bits(btm, r->start, r->start + r->len, r->bits);
+}
+
+/*
+ * writes the rows collected as a PGM image, each pixel being as dark
+ * as the proportion of 1s among the cells it covers.
+ */
+static void
+putdiagram(void)
+{
+	unsigned char *line;
+	struct row *r;
+	long long ones;
+	int lo, hi, cols, span, x, c, k, i;
+
+	lo = hi = 0;
+	for (i = 0; i < nrow; ++i) {
+		if (!i || rows[i].start < lo)
+			lo = rows[i].start;
+		if (!i || rows[i].start + rows[i].len > hi)
+			hi = rows[i].start + rows[i].len;
+	}
+	span = (hi - lo + maxcols - 1) / maxcols;
+	span = MAX(span, 1);
+	cols = MAX((hi - lo + span - 1) / span, 1);
+	if (!(line = malloc(cols)))
+		die("malloc:");
+	fprintf(diagfp, "P5\n%d %d\n255\n", cols, nrow);
+	for (i = 0; i < nrow; ++i) {
+		r = &rows[i];
+		for (x = 0; x < cols; ++x) {
+			ones = 0;
+			for (c = lo + x * span; c < lo + (x + 1) * span; ++c) {
+				k = c - r->start;
+				if (k >= 0 && k < r->len)
+					ones += r->bits[k >> 3] >> (k & 7) & 1;
+			}
+			line[x] = 255 - ones * 255 / span;
+		}
+		fwrite(line, 1, cols, diagfp);
+		free(r->bits);
+	}
+	if (ferror(diagfp))
+		die("fwrite:");
+	free(line);
+	nrow = 0;
+}
+
+/*
+ * runs @btm and collects rows of its space-time diagram every @ts-th
+ * step, doubling @ts and dropping every other row whenever there are
+ * too many of them, then writes the diagram.
+ */
+static long long
+diagram(BTM *btm)
+{
+	long long n, m, ts;
+	int i;
+
+	ts = 1;
+	for (n = 0;; n += m) {
+		if (n % ts == 0 && nrow == maxrows) {
+			for (i = 0; i < nrow; ++i) {
+				if (i & 1)
+					free(rows[i].bits);
+				else
+					rows[i >> 1] = rows[i];
+			}
+			nrow = (nrow + 1) >> 1;
+			ts *= 2;
+		}
+		if (n % ts == 0)
+			addrow(btm);
+		if (n >= nstep || btm_get_state(btm) < 0 || done || full)
+			break;
+		m = advance(btm, MIN(ts - n % ts, nstep - n), &full);
+	}
+	putdiagram();
+	return n;
+}
+
+/*
+ * emulates the BTM loaded into @btm, whose instruction table is @str.
+ */
+static void
+emulate(const char *str)
+{
+	long long n;
+
+	full = 0;
+	if (sflag) {
+		n = advance(btm, nstep, &full);
+	} else if (diagfp) {
+		n = diagram(btm);
+	} else {
+		printf("%s:\n", str);
+		n = dflag ? tracedelta(btm) : trace(btm);
+	}
+	if (done)
+		return;
+	if (full)
+		warn("%s reached the memory limit after %lld steps", str, start + n);
+	if (Bflag) {
+		if (btm_rec_write(btm, -1, btm_get_state(btm) < 0
+		? BTM_REC_FINISHED : BTM_REC_CONTINUES, start + n, stdout))
+			die("btm_rec_write:");
+	} else if (btm_get_state(btm) < 0) {
 		printf("%s finished in %lld steps\n", str, start + n);
 	} else {
 		printf("%s continues after %lld steps", str, start + n);
@@ -110,7 +411,412 @@ handle(char *str)
 			putchar('\n');
 		}
 	}
-	fflush(stdout);
+	outtick();
+}
+
+/*
+ * a line of the form "TABLE continues after N steps: SPECS", as option
+ * -c makes, continues the BTM from step N.
+ */
+static void
+handle(char *str)
+{
+	long long base;
+	char *q;
+	int k;
+
+	base = start;
+	k = 0;
+	if ((q = strstr(str, " continues after "))
+	&& sscanf(q, " continues after %lld steps: %n", &start, &k) == 1 && k)
+		str = q + k;
+	if (load(btm, str))
+		warn("btm_table_load %s:", str);
+	else
+		emulate(str);
+	start = base;
+}
+
+/*
+ * handles the specs in the regular file on stdin, which is mapped and
+ * parsed by NTHREAD threads up front.
+ */
+static void
+handlefile(void)
+{
+	const struct spec *s;
+	struct specs *sp;
+	char *str;
+	long long base;
+	long i;
+
+	if (!(sp = specsopen(0, nthread)))
+		die("specsopen:");
+	base = start;
+	str = NULL;
+	for (i = 0; i < sp->n && !done; ++i) {
+		s = &sp->spec[i];
+		if (!sflag && !diagfp && i)
+			putchar('\n');
+		if (specsload(sp, i, btm)) {
+			warn("stdin:%ld: Invalid BTM specs", s->line);
+			continue;
+		}
+		if (!(str = realloc(str, s->textlen + 1)))
+			die("realloc:");
+		memcpy(str, sp->map + s->text, s->textlen);
+		str[s->textlen] = '\0';
+		start = s->nstep >= 0 ? s->nstep : base;
+		emulate(str);
+	}
+	start = base;
+	free(str);
+	specsclose(sp);
+}
+
+static char *
+mkline(const char *fmt, ...)
+{
+	va_list ap;
+	char *line;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (!(line = malloc(n + 1)))
+		die("malloc:");
+	va_start(ap, fmt);
+	vsprintf(line, fmt, ap);
+	va_end(ap);
+	return line;
+}
+
+/*
+ * updates holdout @h, with instruction table @table, after @btm has run
+ * @n more steps and, if @verdict isn't NULL, been proved by it never to
+ * finish.
+ */
+static void
+settle(struct holdout *h, const char *table, const BTM *btm, long long n,
+const char *verdict, char **buf, size_t *size)
+{
+	h->base += n;
+	free(h->line);
+	if (verdict) {
+		h->verdict = verdict;
+		h->line = mkline("%s never finishes (%s)", table, verdict);
+	} else if (btm_get_state(btm) < 0) {
+		h->nstep = h->base;
+		h->line = mkline("%s finished in %lld steps", table, h->nstep);
+	} else {
+		h->line = mkline("%s,%s", table, dumpconf(btm, buf, size));
+	}
+}
+
+static void *
+work(void *arg)
+{
+	struct holdout *h;
+	BTM *btm;
+	char *str, *buf;
+	size_t size;
+	long long n;
+	int i;
+
+	if (!(btm = btm_new()))
+		die("btm_new:");
+	btm_set_limit(btm, memlimit);
+	buf = NULL;
+	size = 0;
+	for (;;) {
+		pthread_mutex_lock(&holdlock);
+		i = nexthold++;
+		pthread_mutex_unlock(&holdlock);
+		if (i >= nholdout || done)
+			break;
+		h = &holdouts[i];
+		if (!(str = strdup(h->line)))
+			die("strdup:");
+		if (load(btm, str)) {
+			warn("btm_table_load %s:", str);
+			free(str);
+			continue;
+		}
+		n = advance(btm, nstep, &h->full);
+		if (done) {
+			free(str);
+			break;
+		}
+		settle(h, str, btm, n, NULL, &buf, &size);
+		free(str);
+	}
+	pthread_mutex_lock(&holdlock);
+	peak = MAX(peak, btm_get_mem(btm));
+	pthread_mutex_unlock(&holdlock);
+	free(buf);
+	btm_del(btm);
+	return NULL;
+}
+
+static void
+heappush(int i)
+{
+	int k, p;
+
+	for (k = nheap++; k; k = p) {
+		p = (k - 1) >> 1;
+		if (holdouts[heap[p]].base <= holdouts[i].base)
+			break;
+		heap[k] = heap[p];
+	}
+	heap[k] = i;
+}
+
+static int
+heappop(void)
+{
+	int i, k, c;
+
+	i = heap[0];
+	--nheap;
+	for (k = 0; (c = k * 2 + 1) < nheap; k = c) {
+		if (c + 1 < nheap && holdouts[heap[c + 1]].base < holdouts[heap[c]].base)
+			++c;
+		if (holdouts[heap[nheap]].base <= holdouts[heap[c]].base)
+			break;
+		heap[k] = heap[c];
+	}
+	heap[k] = heap[nheap];
+	return i;
+}
+
+/*
+ * runs holdout @h for at most @budget steps, trying the deciders first,
+ * and returns the number of steps executed.
+ */
+static long long
+deepen(BTM *btm, struct holdout *h, long long budget, char **buf, size_t *size)
+{
+	const char *verdict;
+	char *str;
+	long long n, m;
+	int r;
+
+	if (!(str = strdup(h->line)))
+		die("strdup:");
+	if (load(btm, str)) {
+		warn("btm_table_load %s:", str);
+		free(str);
+		h->invalid = 1;
+		return 0;
+	}
+	verdict = NULL;
+	checkfull(r = cycler(btm, MIN(budget / 4, CY_MAXSTEP), &n), &h->full, "cycler");
+	if (r > 0)
+		verdict = "cycler";
+	if (!verdict && !h->full && btm_get_state(btm) >= 0) {
+		checkfull(r = tcycler(btm, MIN(budget / 4, TC_MAXSTEP), &m), &h->full, "tcycler");
+		n += m;
+		if (r > 0)
+			verdict = "translated cycler";
+	}
+	if (!verdict)
+		n += advance(btm, budget - n, &h->full);
+	if (!done) {
+		settle(h, str, btm, n, verdict, buf, size);
+		h->own = 1;
+	}
+	free(str);
+	return n;
+}
+
+static void *
+schedule(void *arg)
+{
+	struct holdout *h;
+	BTM *btm;
+	char *buf;
+	size_t size;
+	long long b, n;
+	int i;
+
+	if (!(btm = btm_new()))
+		die("btm_new:");
+	btm_set_limit(btm, memlimit);
+	buf = NULL;
+	size = 0;
+	pthread_mutex_lock(&holdlock);
+	for (;;) {
+		while (!nheap && nbusy && !done)
+			pthread_cond_wait(&holdcond, &holdlock);
+		if (!nheap || left <= 0 || done)
+			break;
+		i = heappop();
+		h = &holdouts[i];
+		b = MIN(MAX(h->base, ID_MINSTEP), left);
+		left -= b;
+		++nbusy;
+		pthread_mutex_unlock(&holdlock);
+		n = deepen(btm, h, b, &buf, &size);
+		pthread_mutex_lock(&holdlock);
+		left += b - n;
+		--nbusy;
+		if (h->nstep < 0 && !h->verdict && !h->full && !h->invalid)
+			heappush(i);
+		pthread_cond_broadcast(&holdcond);
+	}
+	peak = MAX(peak, btm_get_mem(btm));
+	pthread_cond_broadcast(&holdcond);
+	pthread_mutex_unlock(&holdlock);
+	free(buf);
+	btm_del(btm);
+	return NULL;
+}
+
+static int
+finishedcmp(const void *a, const void *b)
+{
+	const struct holdout *p = a, *q = b;
+
+	if (p->nstep != q->nstep)
+		return p->nstep < q->nstep ? -1 : 1;
+	return strcmp(p->line, q->line);
+}
+
+/*
+ * does a round of btm-cont on @file: the unfinished BTMs are handed out
+ * one at a time to the threads, so a few slow ones don't hold up the
+ * rest, and the file is replaced with one with the step count advanced,
+ * the newly finished BTMs appended to the finished ones in ascending
+ * order of step counts and the unfinished BTMs updated in place.
+ */
+static void
+update(const char *file)
+{
+	FILE *fp;
+	pthread_t *tids;
+	struct holdout *newfin, *h;
+	char **fin;
+	char *p, *q, *tmp;
+	size_t l;
+	ssize_t n;
+	int nfin, nnew, fincap, holdcap, i, k;
+
+	if (!(fp = fopen(file, "r")))
+		die("fopen %s:", file);
+	p = NULL;
+	fin = NULL;
+	nfin = fincap = holdcap = 0;
+	for (i = 0; (n = getline(&p, &l, fp)) != -1; ++i) {
+		if (n && p[n - 1] == '\n')
+			p[--n] = '\0';
+		if (!i && !strncmp(p, "step count:", 11)) {
+			start = xatoll(p + 11 + strspn(p + 11, " \t"));
+			continue;
+		}
+		if (!nholdout && (strstr(p, " finished ") || strstr(p, " never finishes "))) {
+			if (nfin == fincap && !(fin = realloc(fin, (fincap = fincap ? fincap * 2 : 64)
+			* sizeof(*fin))))
+				die("realloc:");
+			if (!(fin[nfin++] = strdup(p)))
+				die("strdup:");
+			continue;
+		}
+		if (!p[strspn(p, " \t")])
+			continue;
+		if (nholdout == holdcap && !(holdouts = realloc(holdouts, (holdcap = holdcap ? holdcap * 2 : 64)
+		* sizeof(*holdouts))))
+			die("realloc:");
+		h = &holdouts[nholdout++];
+		memset(h, 0, sizeof(*h));
+		h->nstep = -1;
+		h->base = start;
+		k = 0;
+		if ((q = strstr(p, " continues after "))
+		&& sscanf(q, " continues after %lld steps: %n", &h->base, &k) == 1 && k) {
+			h->own = 1;
+			q += k;
+		} else {
+			q = p;
+		}
+		if (!(h->line = strdup(q)))
+			die("strdup:");
+	}
+	if (ferror(fp))
+		die("getline:");
+	free(p);
+	fclose(fp);
+	if (iflag) {
+		if (!(heap = malloc((nholdout + 1) * sizeof(*heap))))
+			die("malloc:");
+		for (i = 0; i < nholdout; ++i)
+			heappush(i);
+		left = nholdout && nstep > LLONG_MAX / nholdout ? LLONG_MAX : nstep * nholdout;
+	}
+	if (!(tids = malloc(nthread * sizeof(*tids))))
+		die("malloc:");
+	for (i = 0; i < nthread; ++i)
+		if ((errno = pthread_create(&tids[i], NULL, iflag ? schedule : work, NULL)))
+			die("pthread_create:");
+	for (i = 0; i < nthread; ++i)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	if (done)
+		return;
+	if (!(newfin = malloc((nholdout + 1) * sizeof(*newfin))))
+		die("malloc:");
+	for (i = nnew = 0; i < nholdout; ++i)
+		if (holdouts[i].nstep >= 0)
+			newfin[nnew++] = holdouts[i];
+	qsort(newfin, nnew, sizeof(*newfin), finishedcmp);
+	if (!(tmp = malloc(strlen(file) + 5)))
+		die("malloc:");
+	sprintf(tmp, "%s.tmp", file);
+	if (!(fp = fopen(tmp, "w")))
+		die("fopen %s:", tmp);
+	fprintf(fp, "step count: %lld\n", iflag ? start : start + nstep);
+	for (i = 0; i < nfin; ++i)
+		fprintf(fp, "%s\n", fin[i]);
+	for (i = 0; i < nnew; ++i) {
+		fprintf(fp, "%s\n", newfin[i].line);
+		printf("%s\n", newfin[i].line);
+	}
+	for (i = 0; i < nholdout; ++i) {
+		if (holdouts[i].verdict) {
+			fprintf(fp, "%s\n", holdouts[i].line);
+			printf("%s\n", holdouts[i].line);
+		}
+	}
+	for (i = 0; i < nholdout; ++i) {
+		h = &holdouts[i];
+		if (h->full && h->nstep < 0 && !h->verdict)
+			warn("%.*s reached the memory limit after %lld steps", (int)strcspn(h->line, ","),
+			h->line, h->base);
+	}
+	for (i = 0; i < nholdout; ++i) {
+		h = &holdouts[i];
+		if (h->nstep >= 0 || h->verdict)
+			continue;
+		if (h->own || h->full)
+			fprintf(fp, "%.*s continues after %lld steps: %s\n", (int)strcspn(h->line, ","),
+			h->line, h->base, h->line);
+		else
+			fprintf(fp, "%s\n", h->line);
+	}
+	if (fflush(fp) || fsync(fileno(fp)) || fclose(fp))
+		die("write %s:", tmp);
+	if (rename(tmp, file))
+		die("rename %s:", tmp);
+	free(tmp);
+	for (i = 0; i < nfin; ++i)
+		free(fin[i]);
+	free(fin);
+	for (i = 0; i < nholdout; ++i)
+		free(holdouts[i].line);
+	free(holdouts);
+	free(heap);
+	free(newfin);
 }
 
 int
@@ -118,27 +824,70 @@ main(int argc, char **argv)
 {
 	int c;
 	int i;
-	char *p;
+	char *p, *file;
 	size_t l;
 	ssize_t n;
+	struct sigaction sa;
+	struct stat st;
 
 	progname = argv[0];
-	while ((c = getopt(argc, argv, ":csb:n:h")) != -1) {
+	file = NULL;
+	while ((c = getopt(argc, argv, ":Bcdirsb:g:j:k:n:u:z:M:h")) != -1) {
 		switch (c) {
+		case 'B':
+			Bflag = 1;
+			break;
 		case 'c':
 			cflag = 1;
 			break;
+		case 'd':
+			dflag = 1;
+			break;
+		case 'i':
+			iflag = 1;
+			break;
+		case 'r':
+			rflag = 1;
+			break;
+		case 'g':
+			if (!(diagfp = fopen(optarg, "w")))
+				die("fopen %s:", optarg);
+			break;
+		case 'k':
+			kstep = xatoll(optarg);
+			if (kstep < 1)
+				kstep = 1;
+			break;
+		case 'z':
+			if (sscanf(optarg, "%d,%d%n", &maxcols, &maxrows, &i) != 2 || optarg[i]
+			|| maxcols < 1 || maxrows < 2)
+				die("%s: Invalid diagram size", optarg);
+			break;
 		case 's':
 			sflag = 1;
 			break;
 		case 'b':
 			start = xatoll(optarg);
 			break;
+		case 'j':
+			nthread = xatoi(optarg);
+			if (nthread < 1)
+				nthread = 1;
+			break;
+		case 'u':
+			file = optarg;
+			break;
 		case 'n':
 			nstep = xatoll(optarg);
 			if (nstep <= 0)
 				nstep = LLONG_MAX;
 			break;
+		case 'M':
+			if (xatoll(optarg) < 0)
+				die("%s: Invalid memory limit", optarg);
+			memlimit = xatoll(optarg);
+			Mflag = 1;
+			break;
 		case 'h':
 			usage();
 			return 0;
@@ -148,31 +897,61 @@ main(int argc, char **argv)
 			die("Unrecognized option: -%c", optopt);
 		}
 	}
+	if (Bflag && (!sflag || cflag))
+		die("Option -B requires -s and excludes -c");
+	if (dflag + rflag + (kstep > 1) + !!diagfp + sflag > 1)
+		die("Options -d, -k, -r, -g and -s are mutually exclusive");
 	if (!(btm = btm_new()))
 		die("btm_new:");
-	if (optind == argc || !strcmp(argv[optind], "-")) {
+	btm_set_limit(btm, memlimit);
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = setdone;
+	if (sigaction(SIGTERM, &sa, NULL)
+	|| sigaction(SIGINT, &sa, NULL))
+		die("sigaction:");
+	outinit();
+	if (file) {
+		if (nstep == LLONG_MAX)
+			die("Option -u requires a positive NSTEP");
+		if (optind < argc)
+			die("Too many arguments");
+		update(file);
+	} else if (iflag) {
+		die("Option -i requires -u");
+	} else if ((optind == argc || !strcmp(argv[optind], "-"))
+	&& !fstat(0, &st) && S_ISREG(st.st_mode)) {
+		handlefile();
+	} else if (optind == argc || !strcmp(argv[optind], "-")) {
 		p = NULL;
-		for (i = 0; (n = getline(&p, &l, stdin)) != -1; ++i) {
+		for (i = 0; !done && (n = getline(&p, &l, stdin)) != -1; ++i) {
 			if (p[n - 1] == '\n')
 				p[n - 1] = '\0';
 			if (!p[strspn(p, " \t")]) {
 				--i;
 				continue;
 			}
-			if (!sflag && i)
+			if (!sflag && !diagfp && i)
 				putchar('\n');
 			handle(p);
 		}
-		if (ferror(stdin))
+		if (ferror(stdin) && !done)
 			die("getline:");
 		free(p);
 	} else {
-		for (i = optind; i < argc; ++i) {
-			if (!sflag && i > optind)
+		for (i = optind; i < argc && !done; ++i) {
+			if (!sflag && !diagfp && i > optind)
 				putchar('\n');
 			handle(argv[i]);
 		}
 	}
+	if (fflush(stdout))
+		die("fflush:");
+	if (diagfp && fclose(diagfp))
+		die("fclose:");
+	if (Mflag)
+		warn("Most memory held by a BTM: %zu bytes", MAX(peak, btm_get_mem(btm)));
+	free(rows);
 	btm_del(btm);
 	return 0;
 }
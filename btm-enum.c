@@ -1,13 +1,18 @@
 #define _POSIX_C_SOURCE 200809L /* for getopt() and sigaction() */
-#define _DEFAULT_SOURCE /* for setlinebuf() */
 #include <errno.h>
+#include <limits.h> /* for LLONG_MAX and INT_MAX */
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "btm.h"
+#include "cache.h"
+#include "decide.h"
+#include "seq.h"
 #include "util.h"
 
 static sig_atomic_t done = 0;
@@ -15,16 +20,207 @@ static int size = -1;
 static int len = -1;
 static int flags = 0;
 static int maxout = -1;
-static int aflag = 0, mflag = 0, sflag = 0;
+static int aflag = 0, Bflag = 0, mflag = 0, sflag = 0, Pflag = 0, Sflag = 0, xflag = 0;
 static char *prefix = NULL;
 static long long minrun = 0, maxrun = 0;
 static int maxtry = -1;
 static int zindex = 0;
 static int minrep = 0;
 static int duplen = 0;
+static int nthread = 1;
+static long long mult = 0;
+static int mineperiod = 0;
 
-static char *mark;
-static int *steps;
+static char *ckpath = NULL;
+static long long ckcount = 0;
+static int ckperiod = 60;
+static char *ckopts;
+static BTMIter *ckit = NULL;
+static int ckcall = 0, ncall = 0;
+
+static char *outbuf;
+static int outsize;
+
+/*
+ * only BTMs that have run CACHE_MINSTEP steps without a verdict are
+ * looked up in the cache, as cheaper outcomes aren't worth the trip to
+ * memory.
+ */
+#define CACHE_NSLOT   (1L << 20)
+#define CACHE_MINSTEP 256
+
+static struct cache *cache = NULL;
+
+/*
+ * prefixes are simulated for at most PRUNE_NSTEP steps by useful(),
+ * which keeps a record of every time the head reaches a new cell.
+ */
+#define PRUNE_NSTEP 512
+
+struct record {
+	int step;
+	int state;
+	int head;
+	int lo;
+	int len;
+	int off;
+};
+
+static long long pminrun = 0;
+static char *ptape, *pcycle, *ppool;
+static int *pheads;
+static struct record *precs;
+
+/*
+ * with -E, the prefixes are shards of an enumeration to be run apart.
+ * the cost of a shard is estimated as the number of BTMs it prefixes
+ * times the mean time btmok() takes on NSAMPLE random ones.
+ */
+struct shard {
+	char *prefix;
+	int len;
+	double cost;
+};
+
+static int nsample = 0, maxshare = 0;
+static struct shard *shards;
+static int nshard, shardcap;
+
+/*
+ * with BTM_STATS defined, btmok() notes the stage it's in, and the time
+ * spent, the steps run and the BTMs rejected are charged to the stage.
+ * ST_ITER covers everything outside btmok().
+ */
+enum { ST_ITER, ST_SEP, ST_REP, ST_DEDUP, ST_MINRUN, ST_MAXRUN, ST_OUTPUT, NSTAGE };
+
+static const char *const stagename[NSTAGE] = {
+	"iter", "separable", "repeat", "dedup", "minrun", "maxrun", "output"
+};
+
+#ifdef BTM_STATS
+#define STAT(X) (X)
+#define STAGE(W, S) setstage(W, S)
+
+struct stats {
+	long long ntry;
+	long long nout;
+	long long nhit;
+	long long reject[NSTAGE];
+	long long nstep[NSTAGE];
+	long long ns[NSTAGE];
+	struct btm_stats lib;
+};
+
+static long long t0;
+static int maxtry0;
+static sig_atomic_t dumpreq = 0;
+static pthread_mutex_t statlock = PTHREAD_MUTEX_INITIALIZER;
+#else
+#define STAT(X) ((void)0)
+#define STAGE(W, S) ((W)->stage = (S))
+#endif
+
+/*
+ * with -S, the BTMs are tallied instead of output: the rejected ones by
+ * the stage rejecting them, and the accepted ones that finished by
+ * steps, in power-of-two buckets, and by 1s left on the tape.  the
+ * TOPK finished BTMs with the most steps and with the most 1s are kept,
+ * best first.
+ */
+#define NBUCKET 64
+
+struct top {
+	char *table;
+	long long nstep;
+	int ones;
+};
+
+static int topk = 0;
+static long long nfinish = 0, nrunning = 0;
+static long long nreject[NSTAGE];
+static long long stepshist[NBUCKET];
+static long long *oneshist;
+static int onescap;
+static struct top *topsteps, *topones;
+
+/*
+ * the state of a thread checking BTMs.  @minrun and @maxrun are the
+ * thresholds in effect for the thread, which the mining threads raise
+ * as champions are found, @sig is the signature of the options the
+ * cached outcomes depend on and @looked tells whether the BTM being
+ * checked was looked up in vain.  with BTM_STATS, @stats is only touched by
+ * the thread itself, which copies it to @pub every now and then for
+ * dumps.  @stage is the stage of btmok() the thread is in.
+ *
+ * the BTM has run @pos steps, of which btmok() may not have accounted
+ * for all yet after resume(), and the first @hist are recorded in
+ * @steps.  @snap holds the @nsnap snapshots taken on its way, @cells
+ * the cells they saved, and @seen marks the instructions the BTM has
+ * executed and those never snapshotted.  @changed is the lowest
+ * instruction changed since the BTM last started.
+ */
+struct worker {
+	char *mark;
+	int *steps;
+	int *dups;
+	struct snap *snap;
+	int nsnap;
+	char *seen;
+	char *cells;
+	size_t cellcap;
+	long long pos;
+	long long hist;
+	int changed;
+	long long minrun;
+	long long maxrun;
+	unsigned sig;
+	int looked;
+	int stage;
+	pthread_t tid;
+#ifdef BTM_STATS
+	long long stagestart;
+	const BTM *btm;
+	struct stats stats;
+	struct stats pub;
+#endif
+};
+
+/*
+ * snapshots are only taken before the last NTRACK instructions, which
+ * the iterator changes by far the most often.  a change to any other
+ * makes the next BTM start over from the blank tape.
+ */
+#define NTRACK 2
+
+/*
+ * the most steps the arena of a worker is set up for.
+ */
+#define ARENA_MAXSTEP (1L << 20)
+
+/*
+ * a configuration of the BTM being checked, taken when it was about to
+ * execute the instruction of index @slot for the first time.  the cells
+ * written, from @start to @end, are saved at offset @cells of the
+ * worker's @cells.
+ */
+struct snap {
+	long long pos;
+	int slot;
+	int state;
+	int head;
+	int start;
+	int end;
+	size_t cells;
+};
+
+static struct worker *workers;
+
+/*
+ * the minimum number of steps of the next champion in mining mode.  it
+ * only grows, and it's written under @bestlock but read without it.
+ */
+static long long best;
+static pthread_mutex_t bestlock = PTHREAD_MUTEX_INITIALIZER;
 
 static void
 usage(void)
@@ -39,8 +235,20 @@ usage(void)
 "  -m         avoid mirrored BTMs\n"
 "  -a         if a maximum number of steps is specified with option -t, append\n"
 "             to each BTM a tab and the number of steps it can run\n"
+"  -B         output binary records instead of text (see btm-conv)\n"
 "  -s         exclude separable BTMs\n"
+"  -x         with -e and a MAXRUN, stop running a BTM as soon as it's found to\n"
+"             loop without writing another 1 or to leave its 1s behind for good\n"
 "  -l length  generate LENGTH long BTM prefixes instead of BTMs\n"
+"  -P         with -l, leave out prefixes whose BTMs cycle or finish in less\n"
+"             than MINRUN steps before reading an instruction beyond the\n"
+"             prefix, and, with -m, those making a first move to the left\n"
+"  -E nsample[,maxshare]\n"
+"             with -l, estimate the time the BTMs with each prefix take to\n"
+"             check from NSAMPLE random ones, split the prefixes estimated to\n"
+"             take more than 1/MAXSHARE of the total into longer ones and\n"
+"             output the prefixes longest first, each followed by a tab and\n"
+"             the estimate in seconds\n"
 "  -n maxout  output only MAXOUT results\n"
 "  -p prefix  generate only BTMs prefixed by PREFIX\n"
 "  -r maxtry  if MAXTRY is non-negative, randomly try MAXTRY BTMs, otherwise\n"
@@ -55,6 +263,23 @@ usage(void)
 "  -d duplen  take all steps recorded by the use of option -z, deduplicate\n"
 "             sequences that are at most DUPLEN long and redo repetition\n"
 "             detection in the last 2/3 portion\n"
+"  -w mult[,secs]\n"
+"             mine for champions: randomly generate BTMs and output every one\n"
+"             that runs at least MINRUN steps, raising MINRUN above it and\n"
+"             MAXRUN to MINRUN*MULT at once, for SECS seconds if given\n"
+"  -j nthread with -w, run NTHREAD threads. the default is 1\n"
+"  -S topk    instead of outputting BTMs, print the number of BTMs each filter\n"
+"             rejected, histograms of the steps and of the 1s left on the tape\n"
+"             of the finished BTMs and the TOPK finished BTMs with the most\n"
+"             steps and with the most 1s\n"
+"  -C cache[,nslot]\n"
+"             look up the outcome of every BTM in the file CACHE and record it\n"
+"             there, creating the file with room for NSLOT outcomes (1048576\n"
+"             by default) if it doesn't exist\n"
+"  -k checkpoint[,count[,secs]]\n"
+"             save the progress to CHECKPOINT after every COUNT BTMs if COUNT\n"
+"             is positive, every SECS seconds (60 by default) and upon\n"
+"             SIGTERM/SIGINT, and resume from CHECKPOINT if it exists\n"
 "  -h         show this help message and exit\n"
 	, progname);
 }
@@ -65,8 +290,167 @@ setdone(int sig)
 	done = 1;
 }
 
+static long long
+nsnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#ifdef BTM_STATS
+static void
+setdumpreq(int sig)
+{
+	dumpreq = 1;
+}
+
+static void
+setstage(struct worker *w, int st)
+{
+	long long t;
+
+	t = nsnow();
+	w->stats.ns[w->stage] += t - w->stagestart;
+	w->stagestart = t;
+	w->stage = st;
+}
+
+static void
+addlib(struct btm_stats *dst, const struct btm_stats *src)
+{
+	dst->nrun += src->nrun;
+	dst->nstep += src->nstep;
+	dst->nrealloc += src->nrealloc;
+	dst->nmoved += src->nmoved;
+}
+
+/*
+ * adds the library's counters of the BTM @w is enumerating to those of
+ * the enumerations it finished before.
+ */
+static void
+addlibstats(struct worker *w)
+{
+	struct btm_stats lib;
+
+	if (w->btm && !btm_get_stats(w->btm, &lib))
+		addlib(&w->stats.lib, &lib);
+	w->btm = NULL;
+}
+
+static void
+publish(struct worker *w)
+{
+	struct btm_stats lib;
+
+	pthread_mutex_lock(&statlock);
+	w->pub = w->stats;
+	if (w->btm && !btm_get_stats(w->btm, &lib))
+		addlib(&w->pub.lib, &lib);
+	pthread_mutex_unlock(&statlock);
+}
+
+/*
+ * writes the sum of the counters the workers published to stderr as a
+ * line of key=value pairs.
+ */
+static void
+dumpstats(void)
+{
+	struct stats st;
+	double t, rate;
+	int i, k;
+
+	memset(&st, 0, sizeof(st));
+	pthread_mutex_lock(&statlock);
+	for (k = 0; k < nthread; ++k) {
+		st.ntry += workers[k].pub.ntry;
+		st.nout += workers[k].pub.nout;
+		st.nhit += workers[k].pub.nhit;
+		for (i = 0; i < NSTAGE; ++i) {
+			st.reject[i] += workers[k].pub.reject[i];
+			st.nstep[i] += workers[k].pub.nstep[i];
+			st.ns[i] += workers[k].pub.ns[i];
+		}
+		addlib(&st.lib, &workers[k].pub.lib);
+	}
+	pthread_mutex_unlock(&statlock);
+	t = (nsnow() - t0) / 1e9;
+	rate = t > 0 ? st.ntry / t : 0;
+	fprintf(stderr, "stats elapsed=%.3f tried=%lld output=%lld cached=%lld rate=%.1f",
+	t, st.ntry, st.nout, st.nhit, rate);
+	if ((flags & BTM_RANDOM) && maxtry0 >= 0 && rate > 0)
+		fprintf(stderr, " eta=%.1f", (maxtry0 - st.ntry) / rate);
+	for (i = 0; i < NSTAGE; ++i)
+		fprintf(stderr, " %s.reject=%lld %s.steps=%lld %s.ns=%lld", stagename[i],
+		st.reject[i], stagename[i], st.nstep[i], stagename[i], st.ns[i]);
+	fprintf(stderr, " run.calls=%lld run.steps=%lld tape.realloc=%lld tape.moved=%lld\n",
+	st.lib.nrun, st.lib.nstep, st.lib.nrealloc, st.lib.nmoved);
+	fflush(stderr);
+}
+#endif
+
+/*
+ * a checkpoint comprises the options in effect, the index of the current
+ * enumerate() call, the remaining output and trial quotas and, if
+ * the call has started, the state of its iterator.  it's written to
+ * a temporary file renamed over CHECKPOINT so there's always a complete
+ * one, and stdout is flushed beforehand so that the checkpoint never
+ * runs ahead of the output.
+ */
+static void
+savecheckpoint(const BTMIter *it)
+{
+	char *tmp;
+	FILE *fp;
+
+	if (fflush(stdout))
+		die("fflush:");
+	fsync(1);
+	if (!(tmp = malloc(strlen(ckpath) + 5)))
+		die("malloc:");
+	sprintf(tmp, "%s.tmp", ckpath);
+	if (!(fp = fopen(tmp, "w")))
+		die("fopen %s:", tmp);
+	fprintf(fp, "%s\n%d %d %d\n", ckopts, ncall - 1, maxout, maxtry);
+	if (btm_iter_save(it, fp) || fflush(fp) || fsync(fileno(fp)) || fclose(fp))
+		die("write %s:", tmp);
+	if (rename(tmp, ckpath))
+		die("rename %s:", tmp);
+	free(tmp);
+}
+
+static void
+loadcheckpoint(void)
+{
+	FILE *fp;
+	char *p;
+	size_t l;
+	ssize_t n;
+
+	if (!(fp = fopen(ckpath, "r"))) {
+		if (errno != ENOENT)
+			die("fopen %s:", ckpath);
+		return;
+	}
+	p = NULL;
+	if ((n = getline(&p, &l, fp)) <= 0)
+		die("%s: Invalid checkpoint", ckpath);
+	if (p[n - 1] == '\n')
+		p[n - 1] = '\0';
+	if (strcmp(p, ckopts))
+		die("%s: Checkpoint of an enumeration with different options", ckpath);
+	free(p);
+	if (fscanf(fp, "%d %d %d", &ckcall, &maxout, &maxtry) != 3
+	|| !(ckit = btm_iter_load(fp)))
+		die("%s: Invalid checkpoint", ckpath);
+	fclose(fp);
+}
+
 static int
-separable(const BTM *btm)
+separable(const BTM *btm, char *mark)
 {
 	int q, n, i, j;
 	int changed;
@@ -103,172 +487,820 @@ separable(const BTM *btm)
 	return marked < n;
 }
 
-static int
-repeating(const int *a, int n)
+static long long
+run(struct worker *w, BTM *btm, long long nstep, int *steps)
 {
-	int instr;
-	int p, q, m, i, j;
-
-	q = n / minrep;
-	instr = a[0];
-	for (p = 1; p <= q; ++p) {
-		for (i = p; i < n; i += p)
-			if (a[i] != instr)
-				goto nextp;
-		for (i = p; i < n; i += p) {
-			m = MIN(p, n - i);
-			for (j = 1; j < m; ++j)
-				if (a[j] != a[i + j])
-					goto nextp;
-		}
-		return 1;
-nextp:;
+	long long n;
+
+	if ((n = btm_run_seen(btm, nstep, steps, w->seen)) < 0)
+		die("btm_run_seen:");
+	STAT(w->stats.nstep[w->stage] += n);
+	return n;
+}
+
+/*
+ * saves the configuration of @btm, which has stopped before executing
+ * an instruction for the first time, and marks the instruction seen.
+ */
+static void
+snapshot(struct worker *w, const BTM *btm)
+{
+	struct snap *sn = &w->snap[w->nsnap];
+	BTMView v;
+	size_t off;
+
+	btm_get_view(btm, &v);
+	off = w->nsnap ? sn[-1].cells + (sn[-1].end - sn[-1].start) : 0;
+	if (off + (v.end - v.start) > w->cellcap) {
+		w->cellcap = MAX(w->cellcap * 2, off + (v.end - v.start));
+		if (!(w->cells = realloc(w->cells, w->cellcap)))
+			die("realloc:");
 	}
-	return 0;
+	memcpy(w->cells + off, v.cells, v.end - v.start);
+	sn->pos = w->pos;
+	sn->state = btm_get_state(btm);
+	sn->head = btm_get_head(btm);
+	sn->slot = sn->state * 2 + (btm_get_cell(btm, sn->head) == '1');
+	sn->start = v.start;
+	sn->end = v.end;
+	sn->cells = off;
+	w->seen[sn->slot] = 1;
+	++w->nsnap;
 }
 
+/*
+ * gets @btm ready to run from a blank tape.  the BTM checked before
+ * ran the same way up to the first time it executed an instruction of
+ * index @w->changed or above, so @btm resumes from its latest
+ * configuration before that: the one it ended in if it never did and
+ * is still running, or else the snapshot taken then.  with -z, the
+ * steps before must be in @w->steps as well.
+ */
 static void
-dedup(int *a, int *n)
+resume(struct worker *w, BTM *btm)
 {
-	int i, j, k, m, p;
+	const long long lim = minrep > 1 ? w->hist : LLONG_MAX;
+	struct snap *sn;
+	int k;
 
-	for (i = 0; i < *n - 1; ++i) {
-		m = MIN(duplen, *n - i);
-		for (p = 1; p <= m; ++p) {
-			j = i + p;
-			for (k = 0; k < p && a[i + k] == a[j + k]; ++k)
-				;
-			if (k == p)
-				break;
-		}
-		if (p > m)
-			continue;
-		j = i + p * 2;
-		for (k = p; k; --k)
-			a[j - k] = BTM_FIN;
-		while (j < *n) {
-			for (k = 0; k < p && a[i + k] == a[j + k]; ++k)
-				;
-			if (k < p)
-				break;
-			while (k--)
-				a[j++] = BTM_FIN;
+	k = -1;
+	if (w->changed >= size * 2 - NTRACK) {
+		for (k = 0; k < w->nsnap && w->snap[k].slot < w->changed; ++k)
+			;
+		if (k == w->nsnap && btm_get_state(btm) >= 0 && w->pos <= lim) {
+			w->changed = INT_MAX;
+			w->hist = MIN(w->hist, w->pos);
+			return;
 		}
-		i = j - 1;
+		for (k = MIN(k, w->nsnap - 1); k >= 0 && w->snap[k].pos > lim; --k)
+			;
 	}
-	for (i = j = 1;;) {
-		while (j < *n && a[j] == BTM_FIN)
-			++j;
-		if (j == *n)
-			break;
-		a[i++] = a[j++];
+	w->changed = INT_MAX;
+	for (; w->nsnap > MAX(k, 0); --w->nsnap)
+		w->seen[w->snap[w->nsnap - 1].slot] = 0;
+	btm_reset(btm);
+	w->pos = w->hist = 0;
+	if (k < 0)
+		return;
+	sn = &w->snap[k];
+	if (btm_set_tape(btm, sn->start, sn->end, w->cells + sn->cells))
+		die("btm_set_tape:");
+	if (btm_set_head(btm, sn->head))
+		die("btm_set_head:");
+	btm_set_state(btm, sn->state);
+	w->pos = w->hist = sn->pos;
+}
+
+/*
+ * runs @btm until it has run @to steps in all or finished, setting
+ * *@nstep to the steps run by then, and records the steps if @rec.  the
+ * steps run before resume() count without running again.
+ */
+static void
+runto(struct worker *w, BTM *btm, long long *nstep, long long to, int rec)
+{
+	while (w->pos < to && btm_get_state(btm) >= 0) {
+		w->pos += run(w, btm, to - w->pos, rec ? w->steps + w->pos : NULL);
+		if (rec)
+			w->hist = w->pos;
+		if (w->pos < to && btm_get_state(btm) >= 0)
+			snapshot(w, btm);
 	}
-	*n = i;
+	*nstep = MIN(w->pos, to);
 }
 
+/*
+ * reserves the tape of @btm and the snapshot cells for as many steps as
+ * btmok() may run, up to ARENA_MAXSTEP, so that checking BTMs doesn't
+ * allocate memory once they're set up.
+ */
+static void
+arena(struct worker *w, BTM *btm)
+{
+	long long n;
+
+	n = MAX(w->minrun, w->maxrun);
+	if (minrep > 1)
+		n = MAX(n, (1LL << (zindex - 1)) * 3 + duplen);
+	n = MIN(n, ARENA_MAXSTEP);
+	if (btm_reserve_tape(btm, -n, n + 1))
+		die("btm_reserve_tape:");
+	if (w->cellcap < (size_t)(n + 1) * NTRACK) {
+		w->cellcap = (n + 1) * NTRACK;
+		if (!(w->cells = realloc(w->cells, w->cellcap)))
+			die("realloc:");
+	}
+}
+
+/*
+ * runs @btm like runto() without recording the steps, but with
+ * ncycler(), and returns 1 if the BTM is shown to never finish.  a BTM
+ * that can erase a '1' is left to runto(), as ncycler() wouldn't run it.
+ */
 static int
-btmok(BTM *btm, long long *nstep)
+nloop(struct worker *w, BTM *btm, long long *nstep, long long to)
 {
-	int i, n, t;
+	long long n;
+	int r;
+
+	r = 0;
+	while (!r && w->pos < to && btm_get_state(btm) >= 0 && nonerasing(btm)) {
+		if ((r = ncycler(btm, to - w->pos, &n, w->seen)) < 0)
+			die("ncycler:");
+		STAT(w->stats.nstep[w->stage] += n);
+		w->pos += n;
+		if (!r && w->pos < to && btm_get_state(btm) >= 0)
+			snapshot(w, btm);
+	}
+	*nstep = MIN(w->pos, to);
+	return r;
+}
 
-	if (sflag && separable(btm))
+/*
+ * returns the cached outcome of @btm, or -1 if it isn't due for a lookup
+ * or not found.
+ */
+static int
+lookup(struct worker *w, const BTM *btm, long long *nstep)
+{
+	int ok;
+
+	if (!cache || w->looked || *nstep < CACHE_MINSTEP)
+		return -1;
+	w->looked = 1;
+	if (!cacheget(cache, btm, w->sig, &ok, nstep))
+		return -1;
+	STAT(++w->stats.nhit);
+	w->looked = 0;
+	return ok;
+}
+
+static int
+btmok(struct worker *w, BTM *btm, long long *nstep)
+{
+	const long long minrun = w->minrun, maxrun = w->maxrun;
+	int *const steps = w->steps;
+	int i, n, t, ok;
+
+	STAGE(w, ST_SEP);
+	if (sflag && separable(btm, w->mark))
 		return 0;
-	btm_reset(btm);
+	resume(w, btm);
 	*nstep = 0;
 	if (minrep > 1) {
+		STAGE(w, ST_REP);
 		for (i = 1; i < zindex && 1 << i < minrep; ++i)
 			;
 		n = 1 << (i - 1);
-		*nstep += btm_run(btm, n * 3, steps);
+		runto(w, btm, nstep, n * 3, 1);
 		for (;; n = 1 << i++) {
 			if (btm_get_state(btm) < 0)
 				break;
-			if (repeating(steps + n, n * 2))
+			if (repeating(steps + n, n * 2, minrep))
 				return 0;
+			if ((ok = lookup(w, btm, nstep)) >= 0)
+				return ok;
 			if (i == zindex || (maxrun && *nstep + n * 3 > maxrun))
 				break;
-			*nstep += btm_run(btm, n * 3, steps + n * 3);
+			runto(w, btm, nstep, n * 6, 1);
 		}
 		if (i == zindex && duplen > 0) {
+			STAGE(w, ST_DEDUP);
 			t = n * 3;
-			*nstep += btm_run(btm, duplen, steps + t);
+			runto(w, btm, nstep, t + duplen, 1);
 			if (btm_get_state(btm) >= 0) {
-				dedup(steps, &t);
-				if (repeating(steps + t / 3, t - t / 3))
+				/* the steps are kept for the next BTM */
+				memcpy(w->dups, steps, (t + duplen) * sizeof(*steps));
+				dedup(w->dups, &t, duplen);
+				if (repeating(w->dups + t / 3, t - t / 3, minrep))
 					return 0;
 			}
 		}
 	}
+	if ((ok = lookup(w, btm, nstep)) >= 0)
+		return ok;
 	if (minrun && *nstep < minrun) {
-		*nstep += btm_run(btm, minrun - *nstep, NULL);
+		STAGE(w, ST_MINRUN);
+		runto(w, btm, nstep, minrun, 0);
 		if (*nstep < minrun)
 			return 0;
 	}
 	if (maxrun) {
+		STAGE(w, ST_MAXRUN);
 		if (*nstep > maxrun)
 			return 0;
-		*nstep += btm_run(btm, maxrun - *nstep, NULL);
+		if ((ok = lookup(w, btm, nstep)) >= 0)
+			return ok;
+		if (xflag && nloop(w, btm, nstep, maxrun))
+			return 0;
+		runto(w, btm, nstep, maxrun, 0);
 		if (*nstep == maxrun && btm_get_state(btm) >= 0)
 			return 0;
 	}
 	return 1;
 }
 
+static int
+recorded(const struct record *r, int x)
+{
+	return x >= r->lo && x < r->lo + r->len ? ppool[r->off + x - r->lo] : 0;
+}
+
+/*
+ * tells whether the tape around record @r, as far as the head has been
+ * since, matches the tape around the current position @head.  if it
+ * does, the BTM keeps repeating the same steps shifted along the tape.
+ */
+static int
+translated(const struct record *r, int step, int head)
+{
+	const char *const tape = ptape + PRUNE_NSTEP;
+	int d, m, x, i;
+
+	d = head - r->head;
+	m = r->head;
+	for (i = r->step; i <= step; ++i)
+		m = d > 0 ? MIN(m, pheads[i]) : MAX(m, pheads[i]);
+	for (x = MIN(m, r->head); x <= MAX(m, r->head); ++x)
+		if (recorded(r, x) != tape[x + d])
+			return 0;
+	return 1;
+}
+
+/*
+ * simulates @btm from a blank tape until it reads an instruction beyond
+ * its prefix of @plen instructions.  the prefix is useless if its BTMs finish
+ * in less than MINRUN steps before that, never get there because they
+ * cycle or translate a cycle, or, with -m, move to the left first, in
+ * which case they're mirror images of other BTMs.  returns 0 only in
+ * these cases.
+ */
+static int
+useful(const BTM *btm, int plen)
+{
+	const int n = PRUNE_NSTEP;
+	char *const tape = ptape + n;
+	struct record *r;
+	int lo, hi, h, q, s, t, i;
+	int instr, nrec, off;
+	int cstate, chead;
+
+	memset(ptape, 0, n * 2 + 1);
+	lo = hi = h = q = 0;
+	nrec = off = 0;
+	cstate = chead = -1;
+	pheads[0] = 0;
+	for (t = 0; t < n; ++t) {
+		s = tape[h];
+		if (q * 2 + s >= plen)
+			return 1;
+		instr = btm_get_instr(btm, q, s ? '1' : '0');
+		if (instr == BTM_FIN)
+			return t + 1 >= pminrun;
+		if (!t && mflag && BTM_INSTR_M(instr) == 'L')
+			return 0;
+		tape[h] = BTM_INSTR_S(instr) == '1';
+		h += BTM_INSTR_M(instr) == 'R' ? 1 : -1;
+		q = BTM_INSTR_Q(instr);
+		pheads[t + 1] = h;
+		if (h > hi || h < lo) {
+			lo = MIN(lo, h);
+			hi = MAX(hi, h);
+			for (i = 0; i < nrec; ++i) {
+				r = &precs[i];
+				if (r->state == q && (r->head > 0) == (h > 0)
+				&& translated(r, t + 1, h))
+					return 0;
+			}
+			r = &precs[nrec++];
+			r->step = t + 1;
+			r->state = q;
+			r->head = h;
+			r->lo = lo;
+			r->len = hi - lo + 1;
+			r->off = off;
+			memcpy(ppool + off, tape + lo, r->len);
+			off += r->len;
+		} else if (q == cstate && h == chead && !memcmp(ptape, pcycle, n * 2 + 1)) {
+			return 0;
+		}
+		if (!((t + 1) & t)) {
+			cstate = q;
+			chead = h;
+			memcpy(pcycle, ptape, n * 2 + 1);
+		}
+	}
+	return 1;
+}
+
+/*
+ * the outcome of btmok() depends on these options besides the BTM.
+ */
+static unsigned
+optsig(long long minrun, long long maxrun)
+{
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%d %d %d %d %d %lld %lld", flags & BTM_EXCL_NO_FIN,
+	sflag, minrep, zindex, duplen, minrun, maxrun);
+	return cachesig(buf);
+}
+
+/*
+ * btmok() with the outcome recorded in the cache if it was looked up
+ * there in vain.
+ */
+static int
+cachedok(struct worker *w, BTM *btm, long long *nstep)
+{
+	int ok;
+
+	w->looked = 0;
+	ok = btmok(w, btm, nstep);
+	if (w->looked)
+		cacheput(cache, btm, w->sig, ok, *nstep);
+	return ok;
+}
+
+/*
+ * returns @btm's instruction table as text, cut to the first @l
+ * instructions if @l isn't negative.  the buffer is reused by the next
+ * call.
+ */
+static char *
+dump(const BTM *btm, int l)
+{
+	int n;
+
+	while ((n = btm_table_dump_into(btm, outbuf, outsize)) >= outsize) {
+		if (!(outbuf = realloc(outbuf, outsize = n + 1)))
+			die("realloc:");
+	}
+	if (n < 0)
+		die("btm_table_dump_into:");
+	if (l >= 0)
+		outbuf[n + l - size * 2] = '\0';
+	return outbuf;
+}
+
 static void
-enumerate(const char *prefix)
+output(const BTM *btm, long long nstep)
+{
+	if (Bflag) {
+		if (btm_rec_write(btm, len, aflag ? BTM_REC_STEPS : BTM_REC_NONE, nstep, stdout))
+			die("btm_rec_write:");
+		return;
+	}
+	dump(btm, len);
+	if (aflag)
+		printf("%s\t%lld\n", outbuf, nstep);
+	else
+		puts(outbuf);
+}
+
+static long long
+topkey(const struct top *t, int byones)
+{
+	return byones ? t->ones : t->nstep;
+}
+
+/*
+ * puts @btm into @top, ordered by 1s if @byones is set and by steps
+ * otherwise, if it makes the top TOPK.
+ */
+static void
+keep(struct top *top, const BTM *btm, long long nstep, int ones, int byones)
+{
+	const long long key = byones ? ones : nstep;
+	int i;
+
+	if (!topk || (top[topk - 1].table && topkey(&top[topk - 1], byones) >= key))
+		return;
+	free(top[topk - 1].table);
+	for (i = topk - 1; i > 0 && (!top[i - 1].table || topkey(&top[i - 1], byones) < key); --i)
+		top[i] = top[i - 1];
+	if (!(top[i].table = btm_table_dump(btm)))
+		die("btm_table_dump:");
+	top[i].nstep = nstep;
+	top[i].ones = ones;
+}
+
+static void
+tally(const BTM *btm, long long nstep)
+{
+	int k, ones, n;
+
+	if (btm_get_state(btm) >= 0) {
+		++nrunning;
+		return;
+	}
+	++nfinish;
+	for (k = 0; k < NBUCKET - 1 && nstep >> (k + 1); ++k)
+		;
+	++stepshist[k];
+	if ((ones = btm_get_ones(btm)) >= onescap) {
+		n = MAX(onescap * 2, ones + 1);
+		if (!(oneshist = realloc(oneshist, n * sizeof(*oneshist))))
+			die("realloc:");
+		memset(oneshist + onescap, 0, (n - onescap) * sizeof(*oneshist));
+		onescap = n;
+	}
+	++oneshist[ones];
+	keep(topsteps, btm, nstep, ones, 0);
+	keep(topones, btm, nstep, ones, 1);
+}
+
+/*
+ * prints what tally() gathered, a tab-separated line per figure.
+ */
+static void
+puttally(void)
+{
+	int i;
+
+	printf("finished\t%lld\nunfinished\t%lld\n", nfinish, nrunning);
+	for (i = 0; i < NSTAGE; ++i)
+		if (nreject[i])
+			printf("rejected\t%s\t%lld\n", stagename[i], nreject[i]);
+	for (i = 0; i < NBUCKET; ++i)
+		if (stepshist[i])
+			printf("steps\t%lld-%lld\t%lld\n", 1LL << i, (1LL << i) * 2 - 1, stepshist[i]);
+	for (i = 0; i < onescap; ++i)
+		if (oneshist[i])
+			printf("ones\t%d\t%lld\n", i, oneshist[i]);
+	for (i = 0; i < topk && topsteps[i].table; ++i)
+		printf("top-steps\t%s\t%lld\t%d\n", topsteps[i].table, topsteps[i].nstep,
+		topsteps[i].ones);
+	for (i = 0; i < topk && topones[i].table; ++i)
+		printf("top-ones\t%s\t%lld\t%d\n", topones[i].table, topones[i].nstep,
+		topones[i].ones);
+}
+
+/*
+ * the number of BTMs is exact, but the samples come from the random
+ * iterator, which favors some BTMs over others.
+ */
+static double
+estimate(const char *prefix)
 {
 	BTMIter *it;
 	BTM *btm;
-	long long nstep;
-	char *str;
+	long long nstep, t;
+	double n;
+	int i;
+
+	if (!(it = btm_iter_new(size, flags, prefix, -1)))
+		die("btm_iter_new:");
+	if ((n = btm_iter_count(it)) < 0)
+		die("btm_iter_count:");
+	btm_iter_del(it);
+	if (!(it = btm_iter_new(size, flags | BTM_RANDOM, prefix, -1)))
+		die("btm_iter_new:");
+	if ((btm = btm_iter_deref(it)))
+		arena(&workers[0], btm);
+	t = nsnow();
+	for (i = 0; i < nsample && (btm = btm_iter_deref(it)); ++i, btm_iter_incr(it)) {
+		workers[0].changed = MIN(workers[0].changed, btm_iter_changed(it));
+		btmok(&workers[0], btm, &nstep);
+	}
+	t = nsnow() - t;
+	btm_iter_del(it);
+	return i ? n * t / i / 1e9 : 0;
+}
+
+static void
+addshard(const BTM *btm, int l)
+{
+	struct shard *sh;
+
+	if (nshard == shardcap) {
+		shardcap = shardcap ? shardcap * 2 : 64;
+		if (!(shards = realloc(shards, shardcap * sizeof(*shards))))
+			die("realloc:");
+	}
+	sh = &shards[nshard++];
+	if (!(sh->prefix = strdup(dump(btm, l))))
+		die("strdup:");
+	sh->len = l;
+	sh->cost = estimate(sh->prefix);
+}
+
+static int
+shardcmp(const void *a, const void *b)
+{
+	const struct shard *x = a, *y = b;
+
+	return (x->cost < y->cost) - (x->cost > y->cost);
+}
+
+/*
+ * splits the costliest shard into shards one instruction longer while
+ * it costs more than 1/MAXSHARE of the total, and outputs the shards
+ * costliest first, each with its cost in seconds.
+ */
+static void
+putshards(void)
+{
+	struct shard sh;
+	BTMIter *it;
+	BTM *btm;
+	double total;
+	int i, k;
+
+	while (maxshare) {
+		total = 0;
+		k = -1;
+		for (i = 0; i < nshard; ++i) {
+			total += shards[i].cost;
+			if (shards[i].len < size * 2 && (k < 0 || shards[i].cost > shards[k].cost))
+				k = i;
+		}
+		if (k < 0 || shards[k].cost * maxshare <= total)
+			break;
+		sh = shards[k];
+		shards[k] = shards[--nshard];
+		if (!(it = btm_iter_new(size, flags, sh.prefix, sh.len + 1)))
+			die("btm_iter_new:");
+		for (; (btm = btm_iter_deref(it)); btm_iter_incr(it))
+			if (!Pflag || useful(btm, sh.len + 1))
+				addshard(btm, sh.len + 1);
+		btm_iter_del(it);
+		free(sh.prefix);
+	}
+	qsort(shards, nshard, sizeof(*shards), shardcmp);
+	for (i = 0; i < nshard; ++i) {
+		printf("%s\t%.3g\n", shards[i].prefix, shards[i].cost);
+		free(shards[i].prefix);
+	}
+	free(shards);
+}
+
+/*
+ * with -m, BTMs starting with a move to the left are mirrored, unless
+ * the prefix fixes the first instruction.
+ */
+static void
+unmirror(BTM *btm, const char *prefix)
+{
 	int instr;
 
-	if (!(it = btm_iter_new(size, flags, prefix, len)))
+	if (prefix || !mflag)
+		return;
+	instr = btm_get_instr(btm, 0, '0');
+	if (instr != BTM_FIN && BTM_INSTR_M(instr) == 'L')
+		btm_set_instr(btm, 0, '0', BTM_INSTR(BTM_INSTR_Q(instr), BTM_INSTR_S(instr), 'R'));
+}
+
+static void
+enumerate(const char *prefix)
+{
+	struct worker *w = &workers[0];
+	BTMIter *it;
+	BTM *btm;
+	long long nstep, n;
+	time_t t;
+
+	if (done || ncall++ < ckcall)
+		return;
+	if (ckit) {
+		it = ckit;
+		ckit = NULL;
+	} else if (!(it = btm_iter_new(size, flags, prefix, len))) {
 		die("btm_iter_new:");
+	}
+	if ((btm = btm_iter_deref(it)))
+		arena(w, btm);
+	n = 0;
+	t = time(NULL) + ckperiod;
 	for (; !done && maxout && (btm = btm_iter_deref(it)); btm_iter_incr(it)) {
-		if ((flags & BTM_RANDOM) && !maxtry--)
+		outtick();
+		w->changed = MIN(w->changed, btm_iter_changed(it));
+#ifdef BTM_STATS
+		w->btm = btm;
+		if (dumpreq) {
+			dumpreq = 0;
+			publish(w);
+			dumpstats();
+		}
+#endif
+		if (ckpath && ((ckcount && ++n >= ckcount) || time(NULL) >= t)) {
+			savecheckpoint(it);
+			n = 0;
+			t = time(NULL) + ckperiod;
+		}
+		if ((flags & BTM_RANDOM) && !maxtry)
 			break;
-		if (!prefix && mflag) {
-			instr = btm_get_instr(btm, 0, '0');
-			if (instr != BTM_FIN && BTM_INSTR_M(instr) == 'L')
-				btm_set_instr(btm, 0, '0', BTM_INSTR(BTM_INSTR_Q(instr), BTM_INSTR_S(instr), 'R'));
+		if (maxtry > 0)
+			--maxtry;
+		unmirror(btm, prefix);
+		if (nsample) {
+			if (!Pflag || useful(btm, len))
+				addshard(btm, len);
+			continue;
 		}
-		if (!btmok(btm, &nstep))
+		STAT(++w->stats.ntry);
+		if (!cachedok(w, btm, &nstep) || (Pflag && !useful(btm, len))) {
+			STAT(++w->stats.reject[w->stage]);
+			if (Sflag)
+				++nreject[w->stage];
+			STAGE(w, ST_ITER);
 			continue;
-		if (!(str = btm_table_dump(btm)))
-			die("btm_table_dump:");
-		if (len >= 0)
-			(str + strlen(str))[len - size * 2] = '\0';
-		if (aflag)
-			printf("%s\t%lld\n", str, nstep);
-		else
-			puts(str);
-		free(str);
+		}
+		STAGE(w, ST_OUTPUT);
+		if (Sflag) {
+			tally(btm, nstep);
+		} else {
+			output(btm, nstep);
+		}
 		--maxout;
+		STAT(++w->stats.nout);
+		STAGE(w, ST_ITER);
 	}
+	if (ckpath)
+		savecheckpoint(it);
+	STAT(addlibstats(w));
 	btm_iter_del(it);
 }
 
+/*
+ * outputs a BTM found by a mining thread if it still beats the best
+ * one and raises the threshold for all threads above it.
+ */
+static void
+champion(const BTM *btm, long long nstep)
+{
+	pthread_mutex_lock(&bestlock);
+	if (nstep >= best && maxout && !done) {
+		output(btm, nstep);
+		if (fflush(stdout))
+			die("fflush:");
+		__atomic_store_n(&best, nstep + 1, __ATOMIC_RELAXED);
+		if (!--maxout)
+			done = 1;
+	}
+	pthread_mutex_unlock(&bestlock);
+}
+
+static void *
+mine(void *arg)
+{
+	struct worker *w = arg;
+	BTMIter *it;
+	BTM *btm;
+	long long nstep, b;
+
+	if (!(it = btm_iter_new(size, flags, prefix, -1)))
+		die("btm_iter_new:");
+	if ((btm = btm_iter_deref(it)))
+		arena(w, btm);
+	STAT(w->stagestart = nsnow());
+	for (; !done && (btm = btm_iter_deref(it)); btm_iter_incr(it)) {
+		w->changed = MIN(w->changed, btm_iter_changed(it));
+		if ((b = __atomic_load_n(&best, __ATOMIC_RELAXED)) != w->minrun) {
+			w->minrun = b;
+			w->maxrun = b * mult;
+			w->sig = optsig(w->minrun, w->maxrun);
+			arena(w, btm);
+		}
+		unmirror(btm, prefix);
+#ifdef BTM_STATS
+		w->btm = btm;
+		if (!(++w->stats.ntry & 0xfff))
+			publish(w);
+#endif
+		if (!cachedok(w, btm, &nstep)) {
+			STAT(++w->stats.reject[w->stage]);
+			STAGE(w, ST_ITER);
+			continue;
+		}
+		STAGE(w, ST_OUTPUT);
+		champion(btm, nstep);
+		STAT(++w->stats.nout);
+		STAGE(w, ST_ITER);
+	}
+	STAT(addlibstats(w));
+	btm_iter_del(it);
+	return NULL;
+}
+
+/*
+ * runs the mining threads until the time is up, a signal arrives or
+ * MAXOUT champions are found.
+ */
+static void
+minechampions(void)
+{
+	int i;
+
+	best = minrun;
+	for (i = 0; i < nthread; ++i)
+		if ((errno = pthread_create(&workers[i].tid, NULL, mine, &workers[i])))
+			die("pthread_create:");
+	if (mineperiod)
+		alarm(mineperiod);
+	while (!done) {
+		sleep(1);
+#ifdef BTM_STATS
+		if (dumpreq) {
+			dumpreq = 0;
+			dumpstats();
+		}
+#endif
+	}
+	for (i = 0; i < nthread; ++i)
+		pthread_join(workers[i].tid, NULL);
+}
+
 int
 main(int argc, char **argv)
 {
-	int c, n;
-	char *p;
+	int c, n, i;
+	char *p, *q;
+	char *cachepath = NULL;
+	long nslot = CACHE_NSLOT;
 	struct sigaction sa;
 
 	progname = argv[0];
-	while ((c = getopt(argc, argv, ":cefuamsd:l:n:p:r:t:z:h")) != -1) {
+	while ((c = getopt(argc, argv, ":cefuamsxBPC:E:S:d:j:k:l:n:p:r:t:w:z:h")) != -1) {
 		switch (c) {
 		case 'c': flags |= BTM_CYCLIC; break;
 		case 'e': flags |= BTM_NONERASING; break;
 		case 'f': flags |= BTM_EXCL_NO_FIN; break;
 		case 'u': flags |= BTM_EXCL_MULTI_FIN; break;
 		case 'a': aflag = 1; break;
+		case 'B': Bflag = 1; break;
 		case 'm': mflag = 1; break;
 		case 's': sflag = 1; break;
+		case 'x': xflag = 1; break;
+		case 'P': Pflag = 1; break;
+		case 'C':
+			cachepath = optarg;
+			if ((p = strchr(optarg, ','))) {
+				*p++ = '\0';
+				nslot = xatoll(p);
+			}
+			break;
+		case 'E':
+			if ((p = strchr(optarg, ','))) {
+				*p++ = '\0';
+				maxshare = MAX(xatoi(p), 0);
+			}
+			nsample = xatoi(optarg);
+			if (nsample < 1)
+				die("NSAMPLE must be positive");
+			break;
+		case 'S':
+			Sflag = 1;
+			topk = MAX(xatoi(optarg), 0);
+			break;
 		case 'd':
 			duplen = xatoi(optarg);
 			break;
+		case 'j':
+			nthread = xatoi(optarg);
+			if (nthread < 1)
+				nthread = 1;
+			break;
+		case 'w':
+			if ((p = strchr(optarg, ',')))
+				*p++ = '\0';
+			mult = xatoll(optarg);
+			if (mult < 1)
+				die("MULT must be positive");
+			if (p)
+				mineperiod = xatoi(p);
+			break;
+		case 'k':
+			ckpath = optarg;
+			if (!(p = strchr(optarg, ',')))
+				break;
+			*p++ = '\0';
+			if ((q = strchr(p, ','))) {
+				*q++ = '\0';
+				ckperiod = xatoi(q);
+			}
+			ckcount = xatoll(p);
+			break;
 		case 'l':
 			len = xatoi(optarg);
 			break;
@@ -313,9 +1345,32 @@ main(int argc, char **argv)
 			die("Unrecognized option: -%c", optopt);
 		}
 	}
+	if (mult) {
+		if (len >= 0 || ckpath)
+			die("Option -w excludes -l and -k");
+		if (minrun < 1)
+			die("Option -w requires a positive MINRUN");
+		flags |= BTM_RANDOM;
+		maxrun = minrun * mult;
+		aflag = 1;
+	} else if (nthread > 1) {
+		die("Option -j requires -w");
+	}
+	if (Pflag && len < 0)
+		die("Option -P requires -l");
+	if (nsample && (len < 0 || (flags & BTM_RANDOM) || ckpath || Bflag))
+		die("Option -E requires -l and excludes -r, -k and -B");
+	if (cachepath && len >= 0)
+		die("Option -C excludes -l");
+	if (Sflag && (len >= 0 || mult || ckpath || cachepath || Bflag))
+		die("Option -S excludes -l, -w, -k, -C and -B");
 	if (len >= 0) {
-		aflag = sflag = zindex = 0;
-		minrun = maxrun = minrep = maxtry = 0;
+		pminrun = minrun;
+		aflag = 0;
+		if (!nsample) {
+			sflag = zindex = 0;
+			minrun = maxrun = minrep = maxtry = 0;
+		}
 	}
 	if (argc - optind > 1)
 		die("Too many arguments");
@@ -326,25 +1381,78 @@ main(int argc, char **argv)
 	if (len >= 0 && size < 0)
 		size = len + 1;
 	len = MIN(len, size * 2);
+	/* a letter and at most 10 digits per instruction */
+	if (!(outbuf = malloc(outsize = size * 2 * 11 + 1)))
+		die("malloc:");
 	if (!maxrun)
 		aflag = 0;
 	if (flags & BTM_CYCLIC)
 		sflag = 0;
-	if (!(mark = malloc(size)))
-		die("malloc:");
-	if (minrep > 1) {
-		n = 1 << (zindex - 1);
-		if (!(steps = malloc((n * 3 + duplen) * sizeof(*steps))))
+	if (!(flags & BTM_NONERASING))
+		xflag = 0;
+	if (!(workers = calloc(nthread, sizeof(*workers))))
+		die("calloc:");
+	for (i = 0; i < nthread; ++i) {
+		if (!(workers[i].mark = malloc(size))
+		|| !(workers[i].seen = malloc(size * 2))
+		|| !(workers[i].snap = malloc(size * 2 * sizeof(*workers[i].snap))))
 			die("malloc:");
+		memset(workers[i].seen, 1, size * 2);
+		memset(workers[i].seen + MAX(size * 2 - NTRACK, 0), 0, MIN(size * 2, NTRACK));
+		if (minrep > 1) {
+			n = 1 << (zindex - 1);
+			if (!(workers[i].steps = malloc((n * 3 + duplen) * sizeof(*workers[i].steps)))
+			|| !(workers[i].dups = malloc((n * 3 + duplen) * sizeof(*workers[i].dups))))
+				die("malloc:");
+		}
+		workers[i].minrun = minrun;
+		workers[i].maxrun = maxrun;
+		workers[i].sig = optsig(minrun, maxrun);
+	}
+	if (Sflag && (!(topsteps = calloc(topk + 1, sizeof(*topsteps)))
+	|| !(topones = calloc(topk + 1, sizeof(*topones)))))
+		die("calloc:");
+	if (cachepath && !(cache = cacheopen(cachepath, nslot)))
+		die("cacheopen %s:", cachepath);
+	if (Pflag) {
+		n = PRUNE_NSTEP;
+		if (!(ptape = malloc(n * 2 + 1))
+		|| !(pcycle = malloc(n * 2 + 1))
+		|| !(ppool = malloc((n + 1) * (n + 1)))
+		|| !(pheads = malloc((n + 1) * sizeof(*pheads)))
+		|| !(precs = malloc(n * sizeof(*precs))))
+			die("malloc:");
+	}
+	if (ckpath) {
+		p = "%d %d %d %d %d %d %d %lld %lld %d %d %d %d %lld %d %s";
+		n = snprintf(NULL, 0, p, size, flags, len, aflag, Bflag, mflag, sflag,
+			minrun, maxrun, minrep, zindex, duplen, Pflag, pminrun, xflag,
+			prefix ? prefix : "");
+		if (!(ckopts = malloc(n + 1)))
+			die("malloc:");
+		sprintf(ckopts, p, size, flags, len, aflag, Bflag, mflag, sflag,
+			minrun, maxrun, minrep, zindex, duplen, Pflag, pminrun, xflag,
+			prefix ? prefix : "");
+		loadcheckpoint();
 	}
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = 0;
 	sa.sa_handler = setdone;
 	if (sigaction(SIGTERM, &sa, NULL)
-	|| sigaction(SIGINT, &sa, NULL))
+	|| sigaction(SIGINT, &sa, NULL)
+	|| sigaction(SIGALRM, &sa, NULL))
+		die("sigaction:");
+#ifdef BTM_STATS
+	sa.sa_handler = setdumpreq;
+	if (sigaction(SIGUSR1, &sa, NULL))
 		die("sigaction:");
-	setlinebuf(stdout);
-	if (prefix && prefix[strspn(prefix, " \t")]) {
+	maxtry0 = maxtry;
+	t0 = workers[0].stagestart = nsnow();
+#endif
+	outinit();
+	if (mult) {
+		minechampions();
+	} else if (prefix && prefix[strspn(prefix, " \t")]) {
 		enumerate(prefix);
 	} else if (flags & BTM_RANDOM) {
 		enumerate(NULL);
@@ -366,7 +1474,42 @@ main(int argc, char **argv)
 		enumerate("O");
 		enumerate("I");
 	}
-	free(steps);
-	free(mark);
+	if (Sflag)
+		puttally();
+	if (nsample)
+		putshards();
+	if (fflush(stdout))
+		die("fflush:");
+#ifdef BTM_STATS
+	STAGE(&workers[0], ST_ITER);
+	for (i = 0; i < nthread; ++i)
+		publish(&workers[i]);
+	dumpstats();
+#endif
+	btm_iter_del(ckit);
+	free(ckopts);
+	free(outbuf);
+	for (i = 0; i < nthread; ++i) {
+		free(workers[i].steps);
+		free(workers[i].dups);
+		free(workers[i].mark);
+		free(workers[i].seen);
+		free(workers[i].snap);
+		free(workers[i].cells);
+	}
+	free(workers);
+	cacheclose(cache);
+	free(ptape);
+	free(pcycle);
+	free(ppool);
+	free(pheads);
+	free(precs);
+	for (i = 0; i < topk; ++i) {
+		free(topsteps[i].table);
+		free(topones[i].table);
+	}
+	free(topsteps);
+	free(topones);
+	free(oneshist);
 	return 0;
 }
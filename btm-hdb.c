@@ -0,0 +1,643 @@
+#define _POSIX_C_SOURCE 200809L /* for getopt(), getline(), sigaction() and fsync() */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "btm.h"
+#include "util.h"
+
+#define RUN_CHUNK (1LL << 24)
+#define HDB_MAGIC "BTMHDB1\n"
+#define TABLE_LEN 112
+
+/*
+ * a database file consists of a header, a fixed array of records, one
+ * per BTM, and a data area holding the bit-packed tapes of the records'
+ * snapshots.  all numbers are in native byte order.
+ *
+ * every record has two snapshot slots and @cur tells which one is in
+ * effect.  a BTM is advanced by writing its new snapshot into the other
+ * slot, and once all such writes of a round have been synced to disk
+ * the @cur bytes are flipped and synced in turn, so a crash at any
+ * point leaves every record either at its old or at its new snapshot.
+ */
+struct header {
+	char magic[8];
+	int64_t nrec;
+	int64_t used;    /* bytes used in the data area */
+	int64_t base;    /* step count reached by all the unfinished BTMs */
+	int64_t target;  /* step count the current round advances them to */
+	int64_t nfin;    /* number of ranks handed out to finished BTMs */
+};
+
+struct snap {
+	int64_t steps;
+	int64_t rank;    /* position in the list of finished BTMs */
+	int64_t off;     /* offset of the tape in the data area */
+	int64_t cap;     /* bytes reserved for the tape at @off */
+	int32_t start;   /* tape index of the first cell */
+	int32_t len;     /* number of cells, one bit each */
+	int32_t head;
+	int32_t state;   /* negative if the BTM finished */
+};
+
+struct rec {
+	char table[TABLE_LEN];
+	uint8_t cur;
+	uint8_t pad[7];
+	struct snap snap[2];
+};
+
+static sig_atomic_t done = 0;
+static int nthread = 1;
+static const char *dbpath;
+static int dbfd = -1;
+static unsigned char *map;
+static size_t mapsize;
+static struct header *hdr;
+static struct rec *recs;
+static unsigned char *data;
+static int *idx;
+static int nrun, nidx;
+static unsigned char **pending;
+static char *moved;
+static int nextrec;
+static pthread_mutex_t reclock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+usage(void)
+{
+	printf(
+"usage: %s [options] db\n"
+"options:\n"
+"  -i        create DB from a btm-cont state file read from stdin\n"
+"  -e        write DB to stdout as a btm-cont state file\n"
+"  -n nstep  continue the unfinished BTMs in DB for NSTEP more steps,\n"
+"            updating their records in place, and print the newly\n"
+"            finished ones\n"
+"  -j nthread\n"
+"            with -n, run NTHREAD threads. the default is 1\n"
+"  -f        list the finished BTMs in ascending order of step counts\n"
+"  -h        show this help message and exit\n"
+"without -i, -e, -n or -f, a summary of DB is printed.  an interrupted\n"
+"-n keeps the progress made so far and the next -n, whatever its NSTEP,\n"
+"completes the interrupted round first.  records of BTMs whose tapes\n"
+"outgrow their space are relocated, so re-importing an export of a DB\n"
+"compacts it\n"
+	, progname);
+}
+
+static void
+setdone(int sig)
+{
+	done = 1;
+}
+
+static size_t
+dataoff(int64_t nrec)
+{
+	return sizeof(struct header) + nrec * sizeof(struct rec);
+}
+
+/*
+ * records the state of @btm, which has run @steps steps, in snapshot
+ * @s, leaving the placement of the tape to the caller.
+ */
+static void
+snapshot(const BTM *btm, struct snap *s, long long steps)
+{
+	int i, j;
+
+	btm_get_range(btm, &i, &j);
+	s->steps = steps;
+	s->rank = 0;
+	s->start = i;
+	s->len = j - i;
+	s->head = btm_get_head(btm);
+	s->state = btm_get_state(btm);
+}
+
+/*
+ * sets up @btm as of the current snapshot of record @r.
+ */
+static void
+restore(BTM *btm, const struct rec *r)
+{
+	const struct snap *s;
+
+	s = &r->snap[r->cur];
+	if (btm_table_load(btm, r->table))
+		die("btm_table_load %s:", r->table);
+	btm_reset(btm);
+	if (btm_set_bits(btm, s->start, s->start + s->len, data + s->off)
+	|| btm_set_head(btm, s->head) || btm_set_state(btm, s->state))
+		die("%s: Invalid snapshot", r->table);
+}
+
+static long long
+advance(BTM *btm, long long nstep)
+{
+	long long n, m;
+
+	for (n = 0; n < nstep && btm_get_state(btm) >= 0 && !done; n += m)
+		if ((m = btm_run(btm, MIN(nstep - n, RUN_CHUNK), NULL)) < 0)
+			die("btm_run:");
+	return n;
+}
+
+static void
+lockdb(int type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	if (fcntl(dbfd, F_SETLK, &fl)) {
+		if (errno == EACCES || errno == EAGAIN)
+			die("%s: Database is in use", dbpath);
+		die("fcntl %s:", dbpath);
+	}
+}
+
+static void
+mapdb(int writable)
+{
+	struct stat st;
+
+	if (map && munmap(map, mapsize))
+		die("munmap:");
+	if (fstat(dbfd, &st))
+		die("fstat %s:", dbpath);
+	mapsize = st.st_size;
+	if (mapsize < sizeof(struct header))
+		die("%s: Not a database", dbpath);
+	map = mmap(NULL, mapsize, writable ? PROT_READ|PROT_WRITE : PROT_READ, MAP_SHARED, dbfd, 0);
+	if (map == MAP_FAILED)
+		die("mmap %s:", dbpath);
+	hdr = (struct header *)map;
+	if (memcmp(hdr->magic, HDB_MAGIC, 8))
+		die("%s: Not a database", dbpath);
+	if (hdr->nrec < 0 || hdr->used < 0 || hdr->nrec > INT_MAX
+	|| (mapsize - sizeof(struct header)) / sizeof(struct rec) < hdr->nrec
+	|| mapsize - dataoff(hdr->nrec) < hdr->used)
+		die("%s: Corrupted database", dbpath);
+	recs = (struct rec *)(map + sizeof(struct header));
+	data = map + dataoff(hdr->nrec);
+}
+
+static void
+syncdb(void)
+{
+	if (msync(map, mapsize, MS_SYNC))
+		die("msync %s:", dbpath);
+}
+
+static void
+opendb(int writable)
+{
+	if ((dbfd = open(dbpath, writable ? O_RDWR : O_RDONLY)) < 0)
+		die("open %s:", dbpath);
+	lockdb(writable ? F_WRLCK : F_RDLCK);
+	mapdb(writable);
+}
+
+static int
+indexcmp(const void *a, const void *b)
+{
+	const struct snap *p, *q;
+	int i = *(const int *)a, j = *(const int *)b;
+
+	p = &recs[i].snap[recs[i].cur];
+	q = &recs[j].snap[recs[j].cur];
+	if ((p->state < 0) != (q->state < 0))
+		return p->state < 0 ? 1 : -1;
+	if (p->steps != q->steps)
+		return p->steps < q->steps ? -1 : 1;
+	return i < j ? -1 : i > j;
+}
+
+/*
+ * validates the records and builds the index: the record numbers of
+ * the unfinished BTMs followed by those of the finished ones, both in
+ * ascending order of step counts.
+ */
+static void
+mkindex(void)
+{
+	const struct snap *s;
+	int i, k;
+
+	nidx = hdr->nrec;
+	if (!(idx = malloc((nidx + 1) * sizeof(*idx))))
+		die("malloc:");
+	for (i = nrun = 0; i < nidx; ++i) {
+		if (recs[i].cur > 1 || !memchr(recs[i].table, '\0', TABLE_LEN))
+			die("%s: Corrupted record %d", dbpath, i);
+		for (k = 0; k < 2; ++k) {
+			s = &recs[i].snap[k];
+			if (s->off < 0 || s->cap < 0 || s->len < 0 || s->off > hdr->used
+			|| s->cap > hdr->used - s->off || (s->len + 7) / 8 > s->cap)
+				die("%s: Corrupted record %d", dbpath, i);
+		}
+		nrun += recs[i].snap[recs[i].cur].state >= 0;
+		idx[i] = i;
+	}
+	qsort(idx, nidx, sizeof(*idx), indexcmp);
+}
+
+static void
+putfinished(const struct rec *r)
+{
+	printf("%s finished in %lld steps\n", r->table, (long long)r->snap[r->cur].steps);
+	outtick();
+}
+
+/*
+ * reads a btm-cont state file from stdin.  the records and the data
+ * area are built in memory and written to a temporary file, which then
+ * replaces DB.
+ */
+static void
+import(void)
+{
+	struct header h;
+	struct rec *r;
+	unsigned char *heap;
+	size_t heapsize, heapcap, nb, l;
+	char *line, *p, *q, *tmp;
+	ssize_t n;
+	long long nstep;
+	int cap, lineno, fin, k;
+	FILE *fp;
+	BTM *btm;
+
+	if (!(btm = btm_new()))
+		die("btm_new:");
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, HDB_MAGIC, 8);
+	heap = NULL;
+	heapsize = heapcap = 0;
+	line = NULL;
+	cap = 0;
+	for (lineno = 1; (n = getline(&line, &l, stdin)) != -1; ++lineno) {
+		if (n && line[n - 1] == '\n')
+			line[--n] = '\0';
+		if (lineno == 1 && !strncmp(line, "step count:", 11)) {
+			h.base = xatoll(line + 11 + strspn(line + 11, " \t"));
+			continue;
+		}
+		p = line + strspn(line, " \t");
+		if (!*p)
+			continue;
+		if (h.nrec == cap) {
+			cap = cap ? cap * 2 : 64;
+			if (!(recs = realloc(recs, cap * sizeof(*recs))))
+				die("realloc:");
+		}
+		r = &recs[h.nrec];
+		memset(r, 0, sizeof(*r));
+		fin = 0;
+		if (strstr(p, " continues after ") || strstr(p, " never finishes "))
+			die("stdin:%d: Line written by btm-emul -i", lineno);
+		if ((q = strstr(p, " finished in "))) {
+			fin = 1;
+			if (sscanf(q, " finished in %lld steps%n", &nstep, &k) != 1 || q[k] || nstep < 0)
+				die("stdin:%d: Invalid line", lineno);
+			*q = '\0';
+		} else if ((q = strchr(p, ','))) {
+			*q++ = '\0';
+		}
+		p[strcspn(p, " \t")] = '\0';
+		if (strlen(p) >= TABLE_LEN)
+			die("stdin:%d: Instruction table too long for a database", lineno);
+		strcpy(r->table, p);
+		if (btm_table_load(btm, p))
+			die("stdin:%d: btm_table_load %s:", lineno, p);
+		btm_reset(btm);
+		if (fin) {
+			snapshot(btm, &r->snap[0], nstep);
+			r->snap[0].state = -1;
+			r->snap[0].rank = h.nfin++;
+		} else {
+			if (q && btm_conf_load(btm, q))
+				die("stdin:%d: btm_conf_load %s:", lineno, q);
+			snapshot(btm, &r->snap[0], h.base);
+			if (r->snap[0].state < 0)
+				die("stdin:%d: Finished BTM without step count", lineno);
+			nb = (r->snap[0].len + 7) / 8;
+			if (heapsize + nb > heapcap) {
+				heapcap = MAX(heapcap * 2, heapsize + nb);
+				if (!(heap = realloc(heap, heapcap)))
+					die("realloc:");
+			}
+			btm_get_bits(btm, r->snap[0].start, r->snap[0].start + r->snap[0].len, heap + heapsize);
+			r->snap[0].off = heapsize;
+			r->snap[0].cap = nb;
+			heapsize += nb;
+		}
+		if (++h.nrec > INT_MAX)
+			die("Too many BTMs");
+	}
+	if (ferror(stdin))
+		die("getline:");
+	free(line);
+	h.used = heapsize;
+	h.target = h.base;
+	if (!(tmp = malloc(strlen(dbpath) + 5)))
+		die("malloc:");
+	sprintf(tmp, "%s.tmp", dbpath);
+	if (!(fp = fopen(tmp, "w")))
+		die("fopen %s:", tmp);
+	if (fwrite(&h, sizeof(h), 1, fp) != 1
+	|| fwrite(recs, sizeof(*recs), h.nrec, fp) != h.nrec
+	|| fwrite(heap, 1, heapsize, fp) != heapsize
+	|| fflush(fp) || fsync(fileno(fp)) || fclose(fp))
+		die("write %s:", tmp);
+	if (rename(tmp, dbpath))
+		die("rename %s:", tmp);
+	free(tmp);
+	free(heap);
+	free(recs);
+	btm_del(btm);
+}
+
+static int
+rankcmp(const void *a, const void *b)
+{
+	const struct rec *p = &recs[*(const int *)a], *q = &recs[*(const int *)b];
+	const struct snap *s = &p->snap[p->cur], *t = &q->snap[q->cur];
+
+	if (s->rank != t->rank)
+		return s->rank < t->rank ? -1 : 1;
+	if (s->steps != t->steps)
+		return s->steps < t->steps ? -1 : 1;
+	return strcmp(p->table, q->table);
+}
+
+static void
+export(void)
+{
+	const struct rec *r;
+	char *conf;
+	size_t csize;
+	int *fin;
+	int i, n;
+	BTM *btm;
+
+	if (hdr->base != hdr->target)
+		die("%s: Round to step %lld in progress, complete it with -n first",
+		dbpath, (long long)hdr->target);
+	if (!(btm = btm_new()))
+		die("btm_new:");
+	if (!(fin = malloc((nidx - nrun + 1) * sizeof(*fin))))
+		die("malloc:");
+	memcpy(fin, idx + nrun, (nidx - nrun) * sizeof(*fin));
+	qsort(fin, nidx - nrun, sizeof(*fin), rankcmp);
+	printf("step count: %lld\n", (long long)hdr->base);
+	for (i = 0; i < nidx - nrun; ++i)
+		putfinished(&recs[fin[i]]);
+	conf = NULL;
+	csize = 0;
+	for (i = 0; i < nidx; ++i) {
+		r = &recs[i];
+		if (r->snap[r->cur].state < 0)
+			continue;
+		restore(btm, r);
+		while ((n = btm_conf_dump_into(btm, conf, csize)) >= csize)
+			if (!(conf = realloc(conf, csize = n + 1)))
+				die("realloc:");
+		printf("%s,%s\n", r->table, conf);
+		outtick();
+	}
+	free(conf);
+	free(fin);
+	btm_del(btm);
+}
+
+static void *
+work(void *arg)
+{
+	struct rec *r;
+	struct snap *s, *t;
+	BTM *btm;
+	size_t nb;
+	long long n;
+	int i;
+
+	if (!(btm = btm_new()))
+		die("btm_new:");
+	for (;;) {
+		pthread_mutex_lock(&reclock);
+		i = nextrec++;
+		pthread_mutex_unlock(&reclock);
+		if (i >= nrun || done)
+			break;
+		r = &recs[idx[i]];
+		s = &r->snap[r->cur];
+		if (s->steps >= hdr->target)
+			continue;
+		restore(btm, r);
+		if (!(n = advance(btm, hdr->target - s->steps)))
+			continue;
+		t = &r->snap[!r->cur];
+		snapshot(btm, t, s->steps + n);
+		nb = (t->len + 7) / 8;
+		if (nb <= t->cap) {
+			btm_get_bits(btm, t->start, t->start + t->len, data + t->off);
+		} else {
+			if (!(pending[idx[i]] = malloc(nb)))
+				die("malloc:");
+			btm_get_bits(btm, t->start, t->start + t->len, pending[idx[i]]);
+		}
+		moved[idx[i]] = 1;
+	}
+	btm_del(btm);
+	return NULL;
+}
+
+static int
+finishedcmp(const void *a, const void *b)
+{
+	const struct rec *p = &recs[*(const int *)a], *q = &recs[*(const int *)b];
+	const struct snap *s = &p->snap[!p->cur], *t = &q->snap[!q->cur];
+
+	if (s->steps != t->steps)
+		return s->steps < t->steps ? -1 : 1;
+	return strcmp(p->table, q->table);
+}
+
+/*
+ * makes the snapshots written by the threads take effect.  tapes that
+ * didn't fit into their slots are given new space at the end of the
+ * data area first.
+ */
+static void
+commit(void)
+{
+	struct snap *t;
+	size_t need, nb;
+	int *fin;
+	int i, nfin, lag;
+
+	for (i = 0, need = 0; i < nidx; ++i)
+		if (pending[i])
+			need += ((recs[i].snap[!recs[i].cur].len + 7) / 8 * 3 / 2 + 8) & ~(size_t)7;
+	if (need) {
+		if (ftruncate(dbfd, dataoff(hdr->nrec) + hdr->used + need))
+			die("ftruncate %s:", dbpath);
+		mapdb(1);
+		for (i = 0; i < nidx; ++i) {
+			if (!pending[i])
+				continue;
+			t = &recs[i].snap[!recs[i].cur];
+			nb = (t->len + 7) / 8;
+			t->off = hdr->used;
+			t->cap = (nb * 3 / 2 + 8) & ~(size_t)7;
+			memcpy(data + t->off, pending[i], nb);
+			hdr->used += t->cap;
+			free(pending[i]);
+		}
+	}
+	if (!(fin = malloc((nidx + 1) * sizeof(*fin))))
+		die("malloc:");
+	for (i = nfin = 0; i < nidx; ++i)
+		if (moved[i] && recs[i].snap[!recs[i].cur].state < 0)
+			fin[nfin++] = i;
+	qsort(fin, nfin, sizeof(*fin), finishedcmp);
+	for (i = 0; i < nfin; ++i)
+		recs[fin[i]].snap[!recs[fin[i]].cur].rank = hdr->nfin + i;
+	hdr->nfin += nfin;
+	syncdb();
+	for (i = 0; i < nidx; ++i)
+		if (moved[i])
+			recs[i].cur = !recs[i].cur;
+	syncdb();
+	for (i = lag = 0; i < nrun; ++i) {
+		t = &recs[idx[i]].snap[recs[idx[i]].cur];
+		lag |= t->state >= 0 && t->steps < hdr->target;
+	}
+	if (!lag) {
+		hdr->base = hdr->target;
+		syncdb();
+	}
+	for (i = 0; i < nfin; ++i)
+		putfinished(&recs[fin[i]]);
+	free(fin);
+}
+
+static void
+runround(long long nstep)
+{
+	pthread_t *tids;
+	int i;
+
+	if (hdr->base == hdr->target) {
+		hdr->target = hdr->base + nstep;
+		syncdb();
+	}
+	if (!(pending = calloc(nidx + 1, sizeof(*pending)))
+	|| !(moved = calloc(nidx + 1, 1))
+	|| !(tids = malloc(nthread * sizeof(*tids))))
+		die("malloc:");
+	for (i = 0; i < nthread; ++i)
+		if ((errno = pthread_create(&tids[i], NULL, work, NULL)))
+			die("pthread_create:");
+	for (i = 0; i < nthread; ++i)
+		pthread_join(tids[i], NULL);
+	free(tids);
+	commit();
+	free(pending);
+	free(moved);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sa;
+	long long nstep;
+	int c, i, mode;
+
+	progname = argv[0];
+	mode = 0;
+	nstep = 0;
+	while ((c = getopt(argc, argv, ":efij:n:h")) != -1) {
+		switch (c) {
+		case 'e':
+		case 'f':
+		case 'i':
+			mode = c;
+			break;
+		case 'n':
+			mode = c;
+			nstep = xatoll(optarg);
+			if (nstep <= 0)
+				die("NSTEP must be positive");
+			break;
+		case 'j':
+			nthread = xatoi(optarg);
+			if (nthread < 1)
+				nthread = 1;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case ':':
+			die("Option -%c requires an operand", optopt);
+		default:
+			die("Unrecognized option: -%c", optopt);
+		}
+	}
+	if (argc - optind > 1)
+		die("Too many arguments");
+	if (argc == optind)
+		die("Missing argument");
+	dbpath = argv[optind];
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = setdone;
+	if (sigaction(SIGTERM, &sa, NULL)
+	|| sigaction(SIGINT, &sa, NULL))
+		die("sigaction:");
+	outinit();
+	if (mode == 'i') {
+		import();
+		return 0;
+	}
+	opendb(mode == 'n');
+	mkindex();
+	switch (mode) {
+	case 'e':
+		export();
+		break;
+	case 'f':
+		for (i = nrun; i < nidx; ++i)
+			putfinished(&recs[idx[i]]);
+		break;
+	case 'n':
+		runround(nstep);
+		break;
+	default:
+		printf("step count: %lld\n", (long long)hdr->base);
+		if (hdr->target != hdr->base)
+			printf("round to step %lld in progress\n", (long long)hdr->target);
+		printf("unfinished: %d\nfinished: %d\n", nrun, nidx - nrun);
+		printf("data: %lld bytes\n", (long long)hdr->used);
+		break;
+	}
+	if (fflush(stdout))
+		die("fflush:");
+	munmap(map, mapsize);
+	close(dbfd);
+	free(idx);
+	return 0;
+}
@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L /* for getopt() and sigaction() */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "net.h"
+#include "util.h"
+
+#define BEAT_INTERVAL 1
+
+static const char *enumpath = "./btm-enum";
+static int sock;
+static struct linebuf sockbuf;
+static char *argstr;
+static char **args;
+static int nargs;
+
+static void
+usage(void)
+{
+	printf(
+"usage: %s [options] address\n"
+"options:\n"
+"  -e path  run btm-enum from PATH. the default is ./btm-enum\n"
+"  -h       show this help message and exit\n"
+"the worker connects to a btm-coord at ADDRESS, which is either a path of a\n"
+"Unix domain socket or host:port for TCP, and runs btm-enum on the shards\n"
+"handed out until the campaign is finished\n"
+	, progname);
+}
+
+static char *
+readmsg(void)
+{
+	char *msg;
+	ssize_t n;
+
+	while (!(msg = lbline(&sockbuf))) {
+		if ((n = lbfill(&sockbuf, sock)) < 0)
+			die("read:");
+		if (!n)
+			die("Connection closed by coordinator");
+	}
+	return msg;
+}
+
+/*
+ * btm-enum's options must precede its size argument, so the -p option
+ * for the shard goes in front of the arguments of the campaign.
+ */
+static void
+setargs(char *str)
+{
+	char *p;
+	int n;
+
+	for (n = 0, p = str; *p; ++p)
+		n += *p == '\t';
+	if (!(args = malloc((n + 5) * sizeof(*args))))
+		die("malloc:");
+	args[nargs++] = (char *)enumpath;
+	args[nargs++] = "-p";
+	args[nargs++] = NULL;
+	if (*str) {
+		for (p = strtok(str, "\t"); p; p = strtok(NULL, "\t"))
+			args[nargs++] = p;
+	}
+	args[nargs] = NULL;
+}
+
+static void
+runshard(int id, const char *prefix)
+{
+	struct pollfd pfd;
+	struct linebuf lb;
+	pid_t pid;
+	time_t last;
+	char *line;
+	ssize_t n;
+	int fds[2];
+	int status;
+
+	if (pipe(fds))
+		die("pipe:");
+	if ((pid = fork()) < 0)
+		die("fork:");
+	if (!pid) {
+		close(fds[0]);
+		if (dup2(fds[1], 1) < 0)
+			die("dup2:");
+		close(fds[1]);
+		close(sock);
+		args[2] = (char *)prefix;
+		execvp(enumpath, args);
+		die("execvp %s:", enumpath);
+	}
+	close(fds[1]);
+	memset(&lb, 0, sizeof(lb));
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	last = time(NULL);
+	for (;;) {
+		if ((n = poll(&pfd, 1, BEAT_INTERVAL * 1000)) < 0 && errno != EINTR)
+			break;
+		if (n > 0) {
+			if ((n = lbfill(&lb, fds[0])) <= 0)
+				break;
+			while ((line = lbline(&lb)))
+				if (netsend(sock, "result %d %s\n", id, line))
+					goto lost;
+			last = time(NULL);
+		}
+		if (time(NULL) - last >= BEAT_INTERVAL) {
+			if (netsend(sock, "beat\n"))
+				goto lost;
+			last = time(NULL);
+		}
+	}
+	if (n < 0)
+		warn("read:");
+	if (lb.len > lb.off && netsend(sock, "result %d %.*s\n", id, (int)(lb.len - lb.off), lb.buf + lb.off))
+		goto lost;
+	close(fds[0]);
+	lbfree(&lb);
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR)
+			die("waitpid:");
+	if (n < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		n = netsend(sock, "fail %d status %d\n", id, status);
+	else
+		n = netsend(sock, "end %d\n", id);
+	if (n)
+		die("Connection to coordinator lost:");
+	return;
+lost:
+	kill(pid, SIGTERM);
+	die("Connection to coordinator lost:");
+}
+
+int
+main(int argc, char **argv)
+{
+	struct sigaction sa;
+	struct pollfd pfd;
+	char *msg, *p;
+	int c, id;
+
+	progname = argv[0];
+	while ((c = getopt(argc, argv, ":e:h")) != -1) {
+		switch (c) {
+		case 'e':
+			enumpath = optarg;
+			break;
+		case 'h':
+			usage();
+			return 0;
+		case ':':
+			die("Option -%c requires an operand", optopt);
+		default:
+			die("Unrecognized option: -%c", optopt);
+		}
+	}
+	if (argc - optind > 1)
+		die("Too many arguments");
+	if (argc == optind)
+		die("Missing argument");
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = 0;
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL))
+		die("sigaction:");
+	if ((sock = netconnect(argv[optind])) < 0)
+		die("connect %s:", argv[optind]);
+	msg = readmsg();
+	if (strncmp(msg, "args ", 5))
+		die("Unexpected message: `%s'", msg);
+	if (!(argstr = strdup(msg + 5)))
+		die("strdup:");
+	setargs(argstr);
+	for (;;) {
+		if (netsend(sock, "next\n"))
+			die("Connection to coordinator lost:");
+		msg = readmsg();
+		if (!strcmp(msg, "done"))
+			break;
+		if (!strcmp(msg, "wait")) {
+			/* the coordinator may announce the end of the campaign meanwhile */
+			pfd.fd = sock;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, BEAT_INTERVAL * 1000) > 0 && !strcmp(readmsg(), "done"))
+				break;
+			continue;
+		}
+		if (strncmp(msg, "shard ", 6) || !strchr(msg + 6, ' '))
+			die("Unexpected message: `%s'", msg);
+		p = strchr(msg + 6, ' ');
+		*p++ = '\0';
+		id = xatoi(msg + 6);
+		runshard(id, p);
+	}
+	close(sock);
+	lbfree(&sockbuf);
+	free(argstr);
+	free(args);
+	return 0;
+}
@@ -1,6 +1,8 @@
 #include <errno.h>
 #include <fcntl.h> /* for open() */
-#include <stdio.h> /* for snprintf() */
+#include <limits.h> /* for INT_MIN */
+#include <stdint.h>
+#include <stdio.h> /* for fprintf() and fwrite() */
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h> /* for close() */
@@ -13,6 +15,36 @@
 #define MAX(A, B)      ((A) > (B) ? (A) : (B))
 #define SMASK          2
 #define MMASK          1
+#define KMAXSIZE       8
+#define KFIN           0x80
+#define KNEW           0x40
+
+/*
+ * the cells written so far are exactly those from tapestart to tapeend,
+ * and the head is never more than a cell away from them, so writing a
+ * blank cell under @H extends the range by that cell.
+ */
+#define WIDEN(H, LO, HI) ((H) < (LO) ? ((LO) = (H)) : ((HI) = (H) + 1))
+
+/*
+ * every combination of the iterator flags, BTM_RANDOM to
+ * BTM_EXCL_MULTI_FIN, as an argument of @X.
+ */
+#define NFLAGSET       32
+#define FLAGSETS(X) \
+	X(0)  X(1)  X(2)  X(3)  X(4)  X(5)  X(6)  X(7) \
+	X(8)  X(9)  X(10) X(11) X(12) X(13) X(14) X(15) \
+	X(16) X(17) X(18) X(19) X(20) X(21) X(22) X(23) \
+	X(24) X(25) X(26) X(27) X(28) X(29) X(30) X(31)
+#define ITERPROTO(N) \
+	static void fill##N(BTMIter *it, int start); \
+	static BTMIter *incr##N(BTMIter *it);
+
+#ifdef BTM_STATS
+#define STAT(X)        (X)
+#else
+#define STAT(X)
+#endif
 
 struct btm {
 	int (*table)[2];
@@ -25,6 +57,14 @@ struct btm {
 	int tapestart;
 	int tapeend;
 	int state;
+	int ones;
+	unsigned long gen;
+	size_t limit;
+	uint64_t packed[2];
+	int packok;
+#ifdef BTM_STATS
+	struct btm_stats st;
+#endif
 };
 
 struct btm_iter {
@@ -33,14 +73,26 @@ struct btm_iter {
 	int flags;
 	int len;
 	int prefixlen;
+	int changed;
+	unsigned long long rng;
+	void (*fill)(BTMIter *it, int start);
+	BTMIter *(*incr)(BTMIter *it);
 };
 
 static int str2instr(const char *p, char **ep);
 static int prefixok(BTMIter *it);
 static int reservetable(BTM *btm, int size);
 static int reservetape(BTM *btm, int start, int end);
+static int room(BTM *btm, long long nstep);
+static int cover(BTM *btm, int start, int end);
+static int countones(const char *p, int n);
+static void pack(BTM *btm, const char *seen, uint64_t *t);
+static long long run4(BTM *btm, long long nstep, const uint64_t *t, int *steps);
+static long long run8(BTM *btm, long long nstep, const uint64_t *t, int *steps);
 static int findfin(const int *table, int end);
-static void filltable(BTMIter *it, int start);
+FLAGSETS(ITERPROTO)
+static int seedrand(BTMIter *it);
+static int xrand(BTMIter *it);
 
 int
 str2instr(const char *p, char **ep)
@@ -154,10 +206,18 @@ reservetape(BTM *btm, int start, int end)
 	btm_get_range(btm, &i, &j);
 	newtapesize = end - start;
 	newtapebase = -start;
+	if (btm->limit && (size_t)newtapesize > btm->limit) {
+		errno = ENOBUFS;
+		return -1;
+	}
 	if (!(newtape = realloc(btm->tape, newtapesize)))
 		return -1;
 	btm->tape = newtape;
+	++btm->gen;
+	STAT(++btm->st.nrealloc);
+	STAT(btm->st.nmoved += btm->tapesize);
 	if (newtapebase > btm->tapebase) {
+		STAT(btm->st.nmoved += j - i);
 		memmove(newtape + newtapebase + i, newtape + btm->tapebase + i, j - i);
 		memset(newtape + btm->tapebase + i, 0, newtapebase - btm->tapebase);
 	}
@@ -168,6 +228,176 @@ reservetape(BTM *btm, int start, int end)
 	return 0;
 }
 
+/*
+ * returns how many steps @btm can run, at most @nstep, before its head
+ * may leave the tape, growing the tape first if it's getting short and
+ * the steps won't fit.  returns -1 if growing the tape fails.
+ */
+int
+room(BTM *btm, long long nstep)
+{
+	int h, m, t;
+
+	m = btm->tapesize >> 1;
+	h = btm_get_head(btm);
+	t = MIN(btm->tapebase + h, btm->tapesize - btm->tapebase - h - 1);
+	if (m >> 1 <= t || nstep <= t)
+		return MIN(t, nstep);
+	if (m > nstep >> 1)
+		m = nstep;
+	/* the tape grows by at most m cells on either side */
+	if (btm->limit && (size_t)m * 2 > btm->limit - MIN(btm->limit, (size_t)btm->tapesize)) {
+		m = (btm->limit - MIN(btm->limit, (size_t)btm->tapesize)) / 2;
+		if (m <= t) {
+			if (t)
+				return t;
+			errno = ENOBUFS;
+			return -1;
+		}
+	}
+	if (reservetape(btm, h - m, h + m + 1))
+		return -1;
+	return m;
+}
+
+/*
+ * makes the cells from @start to @end written, with those between them,
+ * the head and the cells already written, so the written cells stay
+ * contiguous.  the cells newly written are '0'.
+ */
+int
+cover(BTM *btm, int start, int end)
+{
+	int h, i, j;
+
+	if (start == end)
+		return 0;
+	h = btm_get_head(btm);
+	i = btm->tapestart == btm->tapeend ? start : MIN(start, btm->tapestart);
+	j = btm->tapestart == btm->tapeend ? end : MAX(end, btm->tapeend);
+	i = MIN(i, h + 1);
+	j = MAX(j, h);
+	/* the range must stay as it is until the tape is reallocated */
+	if (reservetape(btm, i, j))
+		return -1;
+	if (btm->tapestart == btm->tapeend)
+		btm->tapestart = btm->tapeend = start;
+	memset(btm->tape + btm->tapebase + i, '0', btm->tapestart - i);
+	memset(btm->tape + btm->tapebase + btm->tapeend, '0', j - btm->tapeend);
+	btm->tapestart = i;
+	btm->tapeend = j;
+	return 0;
+}
+
+int
+countones(const char *p, int n)
+{
+	int i, k;
+
+	for (i = k = 0; i < n; ++i)
+		k += p[i] == '1';
+	return k;
+}
+
+/*
+ * packs the table of a BTM of at most KMAXSIZE states into @t, a byte
+ * per instruction in the order of the slots, the byte being KFIN for FIN
+ * and for the slots of absent states, as in the unpacked table, and the
+ * instruction otherwise, with KNEW added for a slot not marked in @seen
+ * (if not NULL).  as the state is folded into the slot with the
+ * cell read, a byte shifted right by one and with the low bit cleared is
+ * the slot of the next state at a '0'.  the table is packed again only
+ * after it changes.
+ */
+void
+pack(BTM *btm, const char *seen, uint64_t *t)
+{
+	unsigned char b[KMAXSIZE * 2];
+	uint64_t w;
+	int i, instr;
+
+	if (!btm->packok) {
+		btm->packed[0] = btm->packed[1] = 0x0101010101010101ULL * KFIN;
+		for (i = 0; i < btm->size * 2; ++i) {
+			instr = btm->table[i >> 1][i & 1];
+			if (instr != BTM_FIN)
+				btm->packed[i >> 3] ^= (uint64_t)(instr ^ KFIN) << (i & 7) * 8;
+		}
+		btm->packok = 1;
+	}
+	t[0] = btm->packed[0];
+	t[1] = btm->packed[1];
+	if (!seen)
+		return;
+	memset(b, 1, sizeof(b));
+	memcpy(b, seen, btm->size * 2);
+	for (i = 0; i < 2; ++i) {
+		memcpy(&w, b + i * 8, 8);
+		t[i] |= (~w & 0x0101010101010101ULL) * KNEW;
+	}
+}
+
+/*
+ * the run kernels, for tables packed into NWORD words, which the
+ * compiler keeps in registers.  the slot is the only state carried from
+ * one step to the next, and a cell read is '1' if and only if its low
+ * bit is set.  they return what btm_run_seen() does.
+ */
+#define KERNEL(NAME, NWORD) \
+long long \
+NAME(BTM *btm, long long nstep, const uint64_t *t, int *steps) \
+{ \
+	const uint64_t t0 = t[0], t1 = t[NWORD - 1]; \
+	long long n; \
+	uint64_t e; \
+	char *head, *lo, *hi; \
+	int m, i, c, ones; \
+\
+	e = 0; \
+	i = btm->state << 1 | (*btm->head & 1); \
+	for (n = 0; n < nstep && !(e & (KFIN|KNEW));) { \
+		if ((m = room(btm, nstep - n)) < 0) { \
+			if (n && errno == ENOBUFS) \
+				break; \
+			return -1; \
+		} \
+		head = btm->head; \
+		lo = btm->tape + btm->tapebase + btm->tapestart; \
+		hi = btm->tape + btm->tapebase + btm->tapeend; \
+		ones = btm->ones; \
+		c = *head; \
+		for (; m--; ++n) { \
+			e = (NWORD > 1 && i & 8 ? t1 : t0) >> (i & 7) * 8 & 0xff; \
+			if (e & (KFIN|KNEW)) { \
+				if (e & KNEW) \
+					break; \
+				if (steps) \
+					steps[n] = BTM_FIN; \
+				++n; \
+				break; \
+			} \
+			if (steps) \
+				steps[n] = e; \
+			if (!c) \
+				WIDEN(head, lo, hi); \
+			*head = '0' | (e >> 1 & 1); \
+			ones += (e >> 1 & 1) - (i & 1); \
+			head += e & MMASK ? 1 : -1; \
+			c = *head; \
+			i = (e >> 1 & 14) | (c & 1); \
+		} \
+		btm->head = head; \
+		btm->tapestart = lo - btm->tape - btm->tapebase; \
+		btm->tapeend = hi - btm->tape - btm->tapebase; \
+		btm->ones = ones; \
+		btm->state = (e & (KFIN|KNEW)) == KFIN ? BTM_FIN >> 2 : i >> 1; \
+	} \
+	return n; \
+}
+
+KERNEL(run4, 1)
+KERNEL(run8, 2)
+
 int
 findfin(const int *table, int end)
 {
@@ -179,65 +409,197 @@ findfin(const int *table, int end)
 	return -1;
 }
 
-void
-filltable(BTMIter *it, int start)
+/*
+ * the iterator's fill and increment steps, generated for every set of
+ * flags so that the tests of the flags in the loops fold into constants.
+ * btm_iter_new() and btm_iter_load() pick the pair for the iterator's
+ * flags.
+ *
+ * the symbols and moves count like the digits of a number, the last
+ * slot's lowest.  the packed table, if any, counts along, the symbol and
+ * move being the low bits of a slot's byte.
+ */
+#define ITER(N) \
+void \
+fill##N(BTMIter *it, int start) \
+{ \
+	int *const table = (int *)it->btm->table; \
+	const int size = it->btm->size; \
+	int *const top = it->top; \
+	const int flags = N; \
+	int hadfin; \
+	int i, q, r, n; \
+\
+	if (start >= it->len) \
+		return; \
+	start = MAX(start, it->prefixlen); \
+	hadfin = (flags & (BTM_EXCL_NO_FIN|BTM_EXCL_MULTI_FIN)) && findfin(table, start) >= 0; \
+	q = start >> 1; \
+	if (start & 1) { \
+		n = top[q]; \
+		n += (table[start - 1] >> 2 == n); \
+	} else if (q) { \
+		n = top[q - 1]; \
+		n += (table[start - 2] >> 2 == n); \
+		n += (table[start - 1] >> 2 == n); \
+	} else { \
+		n = 1; \
+	} \
+	for (i = start; i < it->len; ++i) { \
+		q = i >> 1; \
+		if (!(i & 1)) \
+			top[q] = n; \
+		if ((i & 1) && n == q + 1 && n < size) { \
+			table[i] = n << 2; \
+			if (flags & BTM_RANDOM) \
+				table[i] |= xrand(it) & 3; \
+			if (flags & BTM_NONERASING) \
+				table[i] |= SMASK; \
+			++n; \
+			continue; \
+		} \
+		if ((!(flags & BTM_EXCL_MULTI_FIN) || !hadfin) && (!(flags & BTM_RANDOM) \
+		|| !((flags & BTM_EXCL_NO_FIN) && !hadfin ? xrand(it) % (size * 2 - i) : xrand(it) % (size * 2)))) { \
+			table[i] = BTM_FIN; \
+			hadfin = 1; \
+			continue; \
+		} \
+		table[i] = 0; \
+		if (flags & BTM_RANDOM) { \
+			r = xrand(it); \
+			table[i] = r & 3; \
+			r >>= 2; \
+		} \
+		if (flags & BTM_CYCLIC) \
+			table[i] |= ((q + 1) % size) << 2; \
+		else if (flags & BTM_RANDOM) \
+			table[i] |= r % MIN(n + 1, size) << 2; \
+		if (table[i] >> 2 == n) \
+			++n; \
+		if ((i & 1) && (flags & BTM_NONERASING) && table[i] != BTM_FIN) \
+			table[i] |= SMASK; \
+	} \
+} \
+\
+BTMIter * \
+incr##N(BTMIter *it) \
+{ \
+	int *const table = (int *)it->btm->table; \
+	const int size = it->btm->size; \
+	const int flags = N; \
+	uint64_t *packed; \
+	int i, q, n, d; \
+\
+	if (it->len > size * 2) \
+		it->btm->packok = 0; \
+	packed = it->btm->packok ? it->btm->packed : NULL; \
+	if (flags & BTM_RANDOM) { \
+		it->btm->packok = 0; \
+		fill##N(it, 0); \
+		it->changed = 0; \
+		return it; \
+	} \
+	i = it->changed = it->len; \
+	while (i-- > it->prefixlen) { \
+		if (table[i] == BTM_FIN) \
+			continue; \
+		it->changed = i; \
+		if ((table[i] & 3) == 3) { \
+			d = (i & 1) && (flags & BTM_NONERASING) ? MMASK : SMASK | MMASK; \
+			table[i] &= ~d; \
+			if (packed) \
+				packed[i >> 3] &= ~((uint64_t)d << (i & 7) * 8); \
+			continue; \
+		} \
+		++table[i]; \
+		if (packed) \
+			packed[i >> 3] += (uint64_t)1 << (i & 7) * 8; \
+		return it; \
+	} \
+	it->btm->packok = 0; \
+	i = it->len; \
+	if (i == size * 2 && i-- > it->prefixlen) { \
+		it->changed = MIN(it->changed, i); \
+		if (table[i] != BTM_FIN) { \
+			if (!(flags & BTM_CYCLIC) && table[i] >> 2 < size - 1) { \
+				table[i] += 4; \
+				return it; \
+			} \
+		} else if (!(flags & BTM_EXCL_NO_FIN) || findfin(table, i) >= 0) { \
+			table[i] = 0; \
+			if (flags & BTM_NONERASING) \
+				table[i] |= SMASK; \
+			return it; \
+		} \
+	} \
+	while (i-- > it->prefixlen) { \
+		q = i >> 1; \
+		n = it->top[q]; \
+		if ((i & 1) && table[i - 1] >> 2 == n) \
+			++n; \
+		if ((flags & BTM_CYCLIC) || ((i & 1) && n == q + 1 && n < size)) { \
+			if (table[i] == BTM_FIN) { \
+				table[i] = (q + 1) % size << 2; \
+				break; \
+			} \
+		} else if (table[i] >> 2 < MIN(n, size - 1)) { \
+			table[i] += 4; \
+			break; \
+		} \
+	} \
+	if (i < it->prefixlen) { \
+		btm_del(it->btm); \
+		it->btm = NULL; \
+		free(it->top); \
+		it->top = NULL; \
+		return it; \
+	} \
+	if ((i & 1) && (flags & BTM_NONERASING)) \
+		table[i] |= SMASK; \
+	fill##N(it, i + 1); \
+	it->changed = MIN(it->changed, i); \
+	return it; \
+}
+
+FLAGSETS(ITER)
+
+static const struct iterops {
+	void (*fill)(BTMIter *it, int start);
+	BTMIter *(*incr)(BTMIter *it);
+} iterops[] = {
+#define OPS(N) { fill##N, incr##N },
+	FLAGSETS(OPS)
+#undef OPS
+};
+
+int
+seedrand(BTMIter *it)
 {
-	int *const table = (int *)it->btm->table;
-	const int size = it->btm->size;
-	int *const top = it->top;
-	const int flags = it->flags;
-	int hadfin;
-	int i, q, r, n;
+	int fd;
 
-	if (start >= it->len)
-		return;
-	start = MAX(start, it->prefixlen);
-	hadfin = findfin(table, start) >= 0;
-	q = start >> 1;
-	if (start & 1) {
-		n = top[q];
-		n += (table[start - 1] >> 2 == n);
-	} else if (q) {
-		n = top[q - 1];
-		n += (table[start - 2] >> 2 == n);
-		n += (table[start - 1] >> 2 == n);
-	} else {
-		n = 1;
-	}
-	for (i = start; i < it->len; ++i) {
-		q = i >> 1;
-		if (!(i & 1))
-			top[q] = n;
-		if ((i & 1) && n == q + 1 && n < size) {
-			table[i] = n << 2;
-			if (flags & BTM_RANDOM)
-				table[i] |= rand() & 3;
-			if (flags & BTM_NONERASING)
-				table[i] |= SMASK;
-			++n;
-			continue;
-		}
-		if ((!(flags & BTM_EXCL_MULTI_FIN) || !hadfin) && (!(flags & BTM_RANDOM)
-		|| !((flags & BTM_EXCL_NO_FIN) && !hadfin ? rand() % (size * 2 - i) : rand() % (size * 2)))) {
-			table[i] = BTM_FIN;
-			hadfin = 1;
-			continue;
-		}
-		table[i] = 0;
-		if (flags & BTM_RANDOM) {
-			r = rand();
-			table[i] = r & 3;
-			r >>= 2;
-		}
-		if (flags & BTM_CYCLIC)
-			table[i] |= ((q + 1) % size) << 2;
-		else if (flags & BTM_RANDOM)
-			table[i] |= r % MIN(n + 1, size) << 2;
-		if (table[i] >> 2 == n)
-			++n;
-		if ((i & 1) && (flags & BTM_NONERASING) && table[i] != BTM_FIN)
-			table[i] |= SMASK;
+	if ((fd = open("/dev/urandom", O_RDONLY)) < 0)
+		return -1;
+	if (read(fd, &it->rng, sizeof(it->rng)) != sizeof(it->rng)) {
+		close(fd);
+		return -1;
 	}
+	close(fd);
+	it->rng |= 1;
+	return 0;
+}
+
+/*
+ * each iterator has its own xorshift64* generator, so iterators used
+ * by different threads don't contend for the state of rand(3).
+ * returns a non-negative int like rand(3) does.
+ */
+int
+xrand(BTMIter *it)
+{
+	it->rng ^= it->rng >> 12;
+	it->rng ^= it->rng << 25;
+	it->rng ^= it->rng >> 27;
+	return (it->rng * 0x2545f4914f6cdd1dULL) >> 33;
 }
 
 BTM *
@@ -289,13 +651,17 @@ btm_set_head(BTM *btm, int h)
 	if (h < i) {
 		if (reservetape(btm, h, j))
 			return -1;
-		if (h < i - 1)
+		if (h < i - 1) {
 			memset(btm->tape + btm->tapebase + h + 1, '0', i - h - 1);
+			btm->tapestart = h + 1;
+		}
 	} else if (h >= j) {
 		if (reservetape(btm, i, h + 1))
 			return -1;
-		if (h > j)
+		if (h > j) {
 			memset(btm->tape + btm->tapebase + j, '0', h - j);
+			btm->tapeend = h;
+		}
 	}
 	btm->head = btm->tape + btm->tapebase + h;
 	return 0;
@@ -318,6 +684,7 @@ btm_set_instr(BTM *btm, int q, char s, int instr)
 	}
 	r = btm->table[q][s == '1'] >> 2;
 	btm->table[q][s == '1'] = instr;
+	btm->packok = 0;
 	if (r == btm->size - 1 && instr >> 2 < r) {
 		maxq = -1;
 		for (r = 0; r < btm->size; ++r) {
@@ -339,60 +706,173 @@ btm_set_tape(BTM *btm, int start, int end, const char *tape)
 		errno = EINVAL;
 		return -1;
 	}
-	if (reservetape(btm, start, end))
+	if (cover(btm, start, end))
 		return -1;
+	btm->ones += countones(tape, end - start)
+	- countones(btm->tape + btm->tapebase + start, end - start);
 	memcpy(btm->tape + btm->tapebase + start, tape, end - start);
 	return 0;
 }
 
+int
+btm_reserve_tape(BTM *btm, int start, int end)
+{
+	if (start > end) {
+		errno = EINVAL;
+		return -1;
+	}
+	return reservetape(btm, start, end);
+}
+
+void
+btm_set_limit(BTM *btm, size_t limit)
+{
+	btm->limit = limit;
+}
+
 long long
 btm_run(BTM *btm, long long nstep, int *steps)
 {
+	return btm_run_seen(btm, nstep, steps, NULL);
+}
+
+long long
+btm_run_seen(BTM *btm, long long nstep, int *steps, const char *seen)
+{
+	int (*const table)[2] = btm->table;
+	uint64_t t[2];
 	long long n;
-	int h, m, t;
+	char *head, *lo, *hi;
+	int m, s, ones, stop;
 	int instr;
 
 	if (nstep < 0) {
 		errno = EINVAL;
 		return -1;
 	}
+	STAT(++btm->st.nrun);
 	if (btm->state < 0 || !nstep)
 		return 0;
-	for (n = 0; n < nstep;) {
-		m = btm->tapesize >> 1;
-		h = btm_get_head(btm);
-		t = MIN(btm->tapebase + h, btm->tapesize - btm->tapebase - h - 1);
-		if (m >> 1 <= t) {
-			m = MIN(t, nstep - n);
-		} else {
-			if (m > (nstep - n) >> 1)
-				m = nstep - n;
-			if (reservetape(btm, h - m, h + m + 1))
-				return -1;
+	if (btm->size <= KMAXSIZE) {
+		pack(btm, seen, t);
+		n = btm->size <= 4 ? run4(btm, nstep, t, steps) : run8(btm, nstep, t, steps);
+		STAT(btm->st.nstep += MAX(n, 0));
+		return n;
+	}
+	/*
+	 * the tape writes may alias any field of @btm, so the ones touched
+	 * at every step are kept in locals meanwhile.
+	 */
+	instr = btm->state << 2;
+	stop = 0;
+	for (n = 0; n < nstep && instr != BTM_FIN && !stop;) {
+		if ((m = room(btm, nstep - n)) < 0) {
+			if (n && errno == ENOBUFS)
+				break;
+			return -1;
 		}
+		head = btm->head;
+		lo = btm->tape + btm->tapebase + btm->tapestart;
+		hi = btm->tape + btm->tapebase + btm->tapeend;
+		ones = btm->ones;
 		for (; m--; ++n) {
-			instr = btm->table[btm->state][*btm->head == '1'];
-			btm->state = instr >> 2;
+			s = *head == '1';
+			if (seen && !seen[(instr >> 2) * 2 + s]) {
+				stop = 1;
+				break;
+			}
+			instr = table[instr >> 2][s];
 			if (steps)
 				steps[n] = instr;
+			if (instr == BTM_FIN) {
+				++n;
+				break;
+			}
+			if (!*head)
+				WIDEN(head, lo, hi);
+			*head = BTM_INSTR_S(instr);
+			ones += (instr >> 1 & 1) - s;
+			head += instr & MMASK ? 1 : -1;
+		}
+		btm->head = head;
+		btm->tapestart = lo - btm->tape - btm->tapebase;
+		btm->tapeend = hi - btm->tape - btm->tapebase;
+		btm->ones = ones;
+		btm->state = instr >> 2;
+	}
+	STAT(btm->st.nstep += n);
+	return n;
+}
+
+/*
+ * the loop is btm_run()'s with the checks for the events added after
+ * each step.  a cell that has never been written holds '\0'.
+ */
+long long
+btm_run_until(BTM *btm, long long nstep, int events, int q, char s, int *event)
+{
+	const int moves = events & (BTM_EV_LEFT|BTM_EV_RIGHT);
+	const int sq = events & BTM_EV_SLOT ? q : -2;
+	long long n;
+	int m, ev, r, h;
+	int instr;
+
+	ev = 0;
+	if (event)
+		*event = 0;
+	if (nstep < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	STAT(++btm->st.nrun);
+	if (btm->state < 0 || !nstep)
+		return 0;
+	for (n = 0; n < nstep && !ev;) {
+		if ((m = room(btm, nstep - n)) < 0) {
+			if (n && errno == ENOBUFS)
+				break;
+			return -1;
+		}
+		while (m--) {
+			r = *btm->head == '1';
+			instr = btm->table[btm->state][r];
+			btm->state = instr >> 2;
+			++n;
 			if (instr == BTM_FIN)
-				return ++n;
+				break;
+			if (!*btm->head) {
+				h = btm_get_head(btm);
+				if (h < btm->tapestart)
+					btm->tapestart = h;
+				else
+					btm->tapeend = h + 1;
+			}
 			*btm->head = BTM_INSTR_S(instr);
+			btm->ones += (instr >> 1 & 1) - r;
 			btm->head += instr & MMASK ? 1 : -1;
+			if (moves && !*btm->head
+			&& (ev = moves & (instr & MMASK ? BTM_EV_RIGHT : BTM_EV_LEFT)))
+				break;
+			if (btm->state == sq && (!s || (*btm->head == '1') == (s == '1'))) {
+				ev = BTM_EV_SLOT;
+				break;
+			}
 		}
+		if (btm->state < 0)
+			break;
 	}
+	STAT(btm->st.nstep += n);
+	if (event)
+		*event = ev;
 	return n;
 }
 
 void
 btm_reset(BTM *btm)
 {
-	int i, j;
-
-	btm_get_range(btm, &i, &j);
-	memset(btm->tape + btm->tapebase + i, 0, j - i);
+	memset(btm->tape + btm->tapebase + btm->tapestart, 0, btm->tapeend - btm->tapestart);
 	btm->head = btm->tape + btm->tapebase;
-	btm->tapestart = btm->tapeend = btm->state = 0;
+	btm->tapestart = btm->tapeend = btm->state = btm->ones = 0;
 }
 
 int
@@ -470,18 +950,161 @@ btm_get_tape(const BTM *btm, int start, int end)
 void
 btm_get_range(const BTM *btm, int *start, int *end)
 {
-	int i;
+	if (start)
+		*start = btm->tapestart;
+	if (end)
+		*end = btm->tapeend;
+}
+
+int
+btm_get_ones(const BTM *btm)
+{
+	return btm->ones;
+}
+
+void
+btm_get_view(const BTM *btm, BTMView *view)
+{
+	btm_get_range(btm, &view->start, &view->end);
+	view->cells = btm->tape + btm->tapebase + view->start;
+	view->gen = btm->gen;
+}
+
+unsigned long
+btm_get_gen(const BTM *btm)
+{
+	return btm->gen;
+}
+
+size_t
+btm_get_mem(const BTM *btm)
+{
+	return btm->tapesize + btm->tablesize * sizeof(*btm->table);
+}
+
+int
+btm_get_bits(const BTM *btm, int start, int end, unsigned char *bits)
+{
+	const char *p;
+	int i, j, k;
+	unsigned b;
 
-	if (start) {
-		for (i = btm->tapebase + btm->tapestart; i > 0 && btm->tape[i - 1]; --i)
-			;
-		*start = ((BTM *)btm)->tapestart = i - btm->tapebase;
+	if (start > end) {
+		errno = EINVAL;
+		return -1;
 	}
-	if (end) {
-		for (i = btm->tapebase + btm->tapeend; i < btm->tapesize && btm->tape[i]; ++i)
-			;
-		*end = ((BTM *)btm)->tapeend = i - btm->tapebase;
+	memset(bits, 0, (end - start + 7) / 8);
+	i = MAX(start, -btm->tapebase);
+	j = MIN(end, btm->tapesize - btm->tapebase);
+	p = btm->tape + btm->tapebase;
+	for (k = i; k < j && (k - start) & 7; ++k)
+		bits[(k - start) >> 3] |= (p[k] == '1') << ((k - start) & 7);
+	for (; k + 8 <= j; k += 8) {
+		b = (p[k] == '1') | (p[k + 1] == '1') << 1 | (p[k + 2] == '1') << 2
+		| (p[k + 3] == '1') << 3 | (p[k + 4] == '1') << 4 | (p[k + 5] == '1') << 5
+		| (p[k + 6] == '1') << 6 | (p[k + 7] == '1') << 7;
+		bits[(k - start) >> 3] = b;
 	}
+	for (; k < j; ++k)
+		bits[(k - start) >> 3] |= (p[k] == '1') << ((k - start) & 7);
+	return 0;
+}
+
+int
+btm_set_bits(BTM *btm, int start, int end, const unsigned char *bits)
+{
+	char *p;
+	int k;
+
+	if (start > end) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (cover(btm, start, end))
+		return -1;
+	p = btm->tape + btm->tapebase + start;
+	btm->ones -= countones(p, end - start);
+	for (k = 0; k < end - start; ++k) {
+		p[k] = bits[k >> 3] >> (k & 7) & 1 ? '1' : '0';
+		btm->ones += p[k] == '1';
+	}
+	return 0;
+}
+
+int
+btm_get_stats(const BTM *btm, struct btm_stats *st)
+{
+#ifdef BTM_STATS
+	*st = btm->st;
+	return 0;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+int
+btm_conf_load(BTM *btm, const char *str)
+{
+	const char *p;
+	char *ep;
+	long q;
+	int n;
+
+	btm_reset(btm);
+	p = str + strspn(str, " \t");
+	n = strspn(p, "01");
+	if (btm_set_tape(btm, -n + 1, 1, p))
+		return -1;
+	p += n;
+	p += strspn(p, " \t");
+	if (*p++ != '(')
+		goto invalid;
+	errno = 0;
+	q = strtol(p, &ep, 10);
+	if (errno || ep == p || *ep != ')' || q < INT_MIN || btm_set_state(btm, q))
+		goto invalid;
+	p = ep + 1;
+	p += strspn(p, " \t");
+	n = strspn(p, "01");
+	if (btm_set_tape(btm, 1, n + 1, p))
+		return -1;
+	p += n;
+	p += strspn(p, " \t");
+	if (*p)
+		goto invalid;
+	return 0;
+invalid:
+	btm_reset(btm);
+	errno = EINVAL;
+	return -1;
+}
+
+int
+btm_conf_dump_into(const BTM *btm, char *buf, size_t n)
+{
+	char num[16];
+	size_t l;
+	int i, j, h, k, m;
+
+	btm_get_range(btm, &i, &j);
+	h = btm_get_head(btm);
+	i = MIN(i, h);
+	j = MAX(j, h + 1);
+	m = sprintf(num, "(%d)", btm->state);
+	l = 0;
+	for (; i < j; ++i) {
+		/* the head stays within the allocated tape, and so does [i, j) */
+		if (l + 1 < n)
+			buf[l] = btm->tape[btm->tapebase + i] ? btm->tape[btm->tapebase + i] : '0';
+		++l;
+		for (k = 0; i == h && k < m; ++k, ++l)
+			if (l + 1 < n)
+				buf[l] = num[k];
+	}
+	if (n)
+		buf[MIN(l, n - 1)] = '\0';
+	return l;
 }
 
 int
@@ -493,6 +1116,7 @@ btm_table_load(BTM *btm, const char *str)
 	int instr;
 
 	maxq = -1;
+	btm->packok = 0;
 	p = str + strspn(str, " \t");
 	for (i = 0; *p; ++i) {
 		if (!(i & 1) && reservetable(btm, (i >> 1) + 1)) {
@@ -527,42 +1151,155 @@ invalid:
 	return -1;
 }
 
+int
+btm_table_set(BTM *btm, int size, const int *instrs)
+{
+	int i;
+
+	if (size < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (i = 0; i < size * 2; ++i) {
+		if (instrs[i] != BTM_FIN && (instrs[i] >> 2 < 0 || instrs[i] >> 2 >= size)) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+	if (reservetable(btm, size))
+		return -1;
+	memcpy(btm->table, instrs, size * sizeof(*btm->table));
+	btm->size = size;
+	btm->packok = 0;
+	return 0;
+}
+
 char *
 btm_table_dump(const BTM *btm)
 {
-	char *str, *p;
-	int i, l;
-	int instr;
+	char *str;
+	int n;
 
-	if (!btm->size)
+	if ((n = btm_table_dump_into(btm, NULL, 0)) < 0)
 		return NULL;
-	for (i = btm->size, l = 0; i; i /= 10, ++l)
-		;
-	if (!(str = malloc(btm->size * (l + 1) * 2 + 1)))
+	if (!(str = malloc(n + 1)))
 		return NULL;
-	p = str;
+	btm_table_dump_into(btm, str, n + 1);
+	return str;
+}
+
+int
+btm_table_dump_into(const BTM *btm, char *buf, size_t n)
+{
+	char num[12];
+	size_t l;
+	int i, k;
+	int instr;
+	char c;
+
+	if (!btm->size) {
+		errno = EINVAL;
+		return -1;
+	}
+	l = 0;
 	for (i = 0; i < btm->size * 2; ++i) {
 		instr = btm->table[i >> 1][i & 1];
 		if (instr == BTM_FIN) {
-			*p++ = 'f';
-			continue;
+			c = 'f';
+		} else {
+			switch (instr & 3) {
+			case 0: c = 'o'; break;
+			case MMASK: c = 'O'; break;
+			case SMASK: c = 'i'; break;
+			default: c = 'I'; break;
+			}
 		}
-		switch (instr & 3) {
-		case 0: *p++ = 'o'; break;
-		case MMASK: *p++ = 'O'; break;
-		case SMASK: *p++ = 'i'; break;
-		case MMASK|SMASK: *p++ = 'I'; break;
+		if (l + 1 < n)
+			buf[l] = c;
+		++l;
+		if (instr == BTM_FIN || instr >> 2 == ((i >> 1) + 1) % btm->size)
+			continue;
+		for (k = 0, instr >>= 2; instr; instr /= 10)
+			num[k++] = '0' + instr % 10;
+		if (!k)
+			num[k++] = '0';
+		while (k--) {
+			if (l + 1 < n)
+				buf[l] = num[k];
+			++l;
 		}
-		if (instr >> 2 != ((i >> 1) + 1) % btm->size)
-			p += snprintf(p, l + 1, "%d", instr >> 2);
 	}
-	*p++ = '\0';
-	if (!(str = realloc(p = str, strlen(str) + 1))) {
-		free(p);
-		errno = ENOMEM;
-		return NULL;
+	if (n)
+		buf[MIN(l, n - 1)] = '\0';
+	return l;
+}
+
+int
+btm_rec_write(const BTM *btm, int len, int kind, long long nstep, FILE *fp)
+{
+	unsigned char buf[2 + 126 + 10];
+	unsigned long long v;
+	int i, n;
+
+	if (btm->size > 63 || kind < 0 || kind > 3 || nstep < 0 || nstep >> 62) {
+		errno = EINVAL;
+		return -1;
 	}
-	return str;
+	if (len < 0 || len > btm->size * 2)
+		len = btm->size * 2;
+	n = 0;
+	buf[n++] = btm->size;
+	buf[n++] = len;
+	for (i = 0; i < len; ++i)
+		buf[n++] = btm->table[i >> 1][i & 1] + 4;
+	for (v = (unsigned long long)nstep << 2 | kind; v >> 7; v >>= 7)
+		buf[n++] = (v & 0x7f) | 0x80;
+	buf[n++] = v;
+	return fwrite(buf, 1, n, fp) == n ? 0 : -1;
+}
+
+int
+btm_rec_read(BTM *btm, int *len, int *kind, long long *nstep, FILE *fp)
+{
+	unsigned char buf[2 + 126];
+	unsigned long long v;
+	int size, instr;
+	int i, c;
+
+	if ((c = getc(fp)) == EOF)
+		return ferror(fp) ? -1 : 0;
+	buf[0] = c;
+	if (fread(buf + 1, 1, 1, fp) != 1 || buf[0] > 63 || buf[1] > buf[0] * 2
+	|| fread(buf + 2, 1, buf[1], fp) != buf[1])
+		goto invalid;
+	size = buf[0];
+	if (reservetable(btm, size))
+		return -1;
+	btm->packok = 0;
+	for (i = 0; i < size * 2; ++i) {
+		instr = i < buf[1] ? buf[i + 2] - 4 : BTM_FIN;
+		if (instr != BTM_FIN && instr >> 2 >= size)
+			goto invalid;
+		btm->table[i >> 1][i & 1] = instr;
+	}
+	btm->size = size;
+	v = 0;
+	for (i = 0;; i += 7) {
+		/* the 10th byte holds the 64th bit alone */
+		if ((c = getc(fp)) == EOF || (i == 63 && c > 1))
+			goto invalid;
+		v |= (unsigned long long)(c & 0x7f) << i;
+		if (!(c & 0x80))
+			break;
+	}
+	*len = buf[1];
+	*kind = v & 3;
+	*nstep = v >> 2;
+	return 1;
+invalid:
+	if (!ferror(fp))
+		errno = EINVAL;
+	return -1;
 }
 
 BTMIter *
@@ -577,19 +1314,15 @@ btm_iter_new(int size, int flags, const char *prefix, int len)
 		errno = EINVAL;
 		return NULL;
 	}
-	if (flags & BTM_RANDOM) {
-		if ((n = open("/dev/urandom", O_RDONLY)) < 0)
-			return NULL;
-		if (read(n, &i, sizeof(i)) != sizeof(i)) {
-			close(n);
-			return NULL;
-		}
-		close(n);
-		srand(i);
-	}
 	if (!(it = calloc(1, sizeof(*it))))
 		return NULL;
+	if ((flags & BTM_RANDOM) && seedrand(it)) {
+		free(it);
+		return NULL;
+	}
 	it->flags = flags;
+	it->fill = iterops[flags & (NFLAGSET - 1)].fill;
+	it->incr = iterops[flags & (NFLAGSET - 1)].incr;
 	if (!size)
 		return it;
 	if (!(it->btm = btm_new())
@@ -630,7 +1363,7 @@ btm_iter_new(int size, int flags, const char *prefix, int len)
 		}
 	}
 	it->len = len < it->prefixlen ? size * 2 : len;
-	filltable(it, 0);
+	it->fill(it, 0);
 	return it;
 invalid:
 	btm_iter_del(it);
@@ -651,78 +1384,148 @@ btm_iter_del(BTMIter *it)
 BTMIter *
 btm_iter_incr(BTMIter *it)
 {
-	int *table;
-	int size;
-	int flags;
-	int i, q, n;
-
 	if (!it->btm)
 		return it;
-	table = (int *)it->btm->table;
-	size = it->btm->size;
-	flags = it->flags;
-			n += (table[i] == BTM_FIN);
-	if (flags & BTM_RANDOM) {
-		filltable(it, 0);
-		return it;
+	return it->incr(it);
+}
+
+int
+btm_iter_save(const BTMIter *it, FILE *fp)
+{
+	const int *table;
+	int size, i;
+
+	size = it->btm ? it->btm->size : 0;
+	if (fprintf(fp, "%d %d %d %d", size, it->flags, it->len, it->prefixlen) < 0)
+		return -1;
+	if (size) {
+		table = (int *)it->btm->table;
+		for (i = 0; i < size * 2; ++i)
+			if (fprintf(fp, " %d", table[i]) < 0)
+				return -1;
+		for (i = 0; i < size; ++i)
+			if (fprintf(fp, " %d", it->top[i]) < 0)
+				return -1;
 	}
-	i = it->len;
-	while (i-- > it->prefixlen) {
-		if (table[i] == BTM_FIN)
-			continue;
-		if ((table[i] & 3) == 3) {
-			if ((i & 1) && (flags & BTM_NONERASING))
-				table[i] &= ~MMASK;
-			else
-				table[i] &= ~3;
-			continue;
-		}
-		if ((i & 1) && (flags & BTM_NONERASING))
-			table[i] |= MMASK;
-		else
-			++table[i];
+	return fputc('\n', fp) == EOF ? -1 : 0;
+}
+
+BTMIter *
+btm_iter_load(FILE *fp)
+{
+	BTMIter *it;
+	int *table;
+	int size, flags, len, prefixlen;
+	int i;
+
+	if (fscanf(fp, "%d %d %d %d", &size, &flags, &len, &prefixlen) != 4
+	|| size < 0 || prefixlen < 0 || len < prefixlen || (size && len > size * 2)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!(it = calloc(1, sizeof(*it))))
+		return NULL;
+	if ((flags & BTM_RANDOM) && seedrand(it)) {
+		free(it);
+		return NULL;
+	}
+	it->flags = flags;
+	it->fill = iterops[flags & (NFLAGSET - 1)].fill;
+	it->incr = iterops[flags & (NFLAGSET - 1)].incr;
+	it->len = len;
+	it->prefixlen = prefixlen;
+	if (!size)
 		return it;
+	if (!(it->btm = btm_new())
+	|| !(it->top = calloc(size, sizeof(*it->top)))
+	|| reservetable(it->btm, size)) {
+		btm_iter_del(it);
+		errno = ENOMEM;
+		return NULL;
 	}
-	i = it->len;
-	if (i == size * 2 && i-- > it->prefixlen) {
-		if (table[i] != BTM_FIN) {
-			if (!(flags & BTM_CYCLIC) && table[i] >> 2 < size - 1) {
-				table[i] += 4;
-				return it;
-			}
-		} else if (!(flags & BTM_EXCL_NO_FIN) || findfin(table, i) >= 0) {
-			table[i] = 0;
-			if (flags & BTM_NONERASING)
-				table[i] |= SMASK;
-			return it;
-		}
+	it->btm->size = size;
+	table = (int *)it->btm->table;
+	for (i = 0; i < size * 2; ++i)
+		if (fscanf(fp, "%d", &table[i]) != 1 || (table[i] != BTM_FIN
+		&& (table[i] >> 2 < 0 || table[i] >> 2 >= size)))
+			goto invalid;
+	for (i = 0; i < size; ++i)
+		if (fscanf(fp, "%d", &it->top[i]) != 1 || it->top[i] < 1 || it->top[i] > size)
+			goto invalid;
+	return it;
+invalid:
+	btm_iter_del(it);
+	errno = EINVAL;
+	return NULL;
+}
+
+/*
+ * mirrors the choices the fill and increment steps make for a slot.
+ * going from the last slot back to the prefix, @cnt[n * 2 + f] is the
+ * number of ways to fill the slots after the current one, given that
+ * @n states are used and there's a FIN before if @f is set.
+ */
+double
+btm_iter_count(const BTMIter *it)
+{
+	const int flags = it->flags;
+	const int *table;
+	double *buf, *cnt, *next, *tmp;
+	double x;
+	int size, i, q, n, f, c, fin;
+
+	if (flags & BTM_RANDOM) {
+		errno = EINVAL;
+		return -1;
 	}
-	while (i-- > it->prefixlen) {
+	if (!it->btm)
+		return 0;
+	size = it->btm->size;
+	table = (int *)it->btm->table;
+	if (!(buf = malloc((size + 2) * 4 * sizeof(*buf))))
+		return -1;
+	cnt = buf;
+	next = buf + (size + 2) * 2;
+	for (i = 0; i < (size + 2) * 2; ++i)
+		cnt[i] = 1;
+	for (i = it->len - 1; i >= it->prefixlen; --i) {
 		q = i >> 1;
-		n = it->top[q];
-		if ((i & 1) && table[i - 1] >> 2 == n)
-			++n;
-		if ((flags & BTM_CYCLIC) || ((i & 1) && n == q + 1 && n < size)) {
-			if (table[i] == BTM_FIN) {
-				table[i] = (q + 1) % size << 2;
-				break;
+		c = (i & 1) && (flags & BTM_NONERASING) ? 2 : 4;
+		for (n = 1; n <= size; ++n) {
+			for (f = 0; f < 2; ++f) {
+				fin = !(flags & BTM_EXCL_MULTI_FIN) || !f;
+				x = 0;
+				if ((i & 1) && n == q + 1 && n < size) {
+					x = c * cnt[(n + 1) * 2 + f];
+				} else if (i == size * 2 - 1) {
+					if (fin)
+						x = cnt[n * 2 + 1];
+					if (!(flags & BTM_EXCL_NO_FIN) || f)
+						x += c * (flags & BTM_CYCLIC ? 1 : size) * cnt[n * 2 + f];
+				} else {
+					if (fin)
+						x = cnt[n * 2 + 1];
+					if (flags & BTM_CYCLIC)
+						x += c * cnt[(n + ((q + 1) % size == n)) * 2 + f];
+					else if (n < size)
+						x += c * (n * cnt[n * 2 + f] + cnt[(n + 1) * 2 + f]);
+					else
+						x += c * size * cnt[n * 2 + f];
+				}
+				next[n * 2 + f] = x;
 			}
-		} else if (table[i] >> 2 < MIN(n, size - 1)) {
-			table[i] += 4;
-			break;
 		}
+		tmp = cnt;
+		cnt = next;
+		next = tmp;
 	}
-	if (i < it->prefixlen) {
-		btm_del(it->btm);
-		it->btm = NULL;
-		free(it->top);
-		it->top = NULL;
-		return it;
-	}
-	if ((i & 1) && (flags & BTM_NONERASING))
-		table[i] |= SMASK;
-	filltable(it, i + 1);
-	return it;
+	n = 1;
+	for (i = 0; i < it->prefixlen; ++i)
+		if (table[i] >> 2 == n)
+			++n;
+	x = cnt[n * 2 + (findfin(table, it->prefixlen) >= 0)];
+	free(buf);
+	return x;
 }
 
 BTM *
@@ -730,3 +1533,9 @@ btm_iter_deref(const BTMIter *it)
 {
 	return it->btm;
 }
+
+int
+btm_iter_changed(const BTMIter *it)
+{
+	return it->changed;
+}
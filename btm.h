@@ -1,6 +1,8 @@
 #ifndef BTM_H_
 #define BTM_H_
 
+#include <stdio.h> /* for FILE */
+
 /*
  * packs a transition target @Q (a state number), a symbol to write @S
  * (character '0' or '1') and a move @M (character 'L' or 'R') into
@@ -39,6 +41,31 @@
 #define BTM_EXCL_NO_FIN    1 << 3
 #define BTM_EXCL_MULTI_FIN 1 << 4
 
+/*
+ * kinds of the step count carried by a binary BTM record:
+ *
+ * BTM_REC_NONE      - no step count
+ * BTM_REC_STEPS     - the number of steps the BTM runs, as appended by
+ *                     btm-enum's -a option
+ * BTM_REC_FINISHED  - the BTM finished in that many steps
+ * BTM_REC_CONTINUES - the BTM continues after that many steps
+ */
+#define BTM_REC_NONE       0
+#define BTM_REC_STEPS      1
+#define BTM_REC_FINISHED   2
+#define BTM_REC_CONTINUES  3
+
+/*
+ * counters a BTM object keeps when the library is compiled with
+ * BTM_STATS defined, retrieved with btm_get_stats().
+ */
+struct btm_stats {
+	long long nrun;      /* calls to btm_run() */
+	long long nstep;     /* steps executed by btm_run() */
+	long long nrealloc;  /* reallocations of the tape */
+	long long nmoved;    /* bytes copied or moved by the reallocations */
+};
+
 /*
  * opaque data type for BTM. a BTM object comprises an instruction table,
  * a tape, a state register and a head.  conceptually, the tape is an
@@ -53,6 +80,21 @@ typedef struct btm BTM;
  */
 typedef struct btm_iter BTMIter;
 
+/*
+ * a read-only view of the written range of a BTM's tape, filled in by
+ * btm_get_view().  @cells[i - @start] is the symbol ('0' or '1') of the
+ * cell at tape index i, for @start <= i < @end.  the view points into
+ * the BTM's own storage, so it reflects later writes to those cells,
+ * and it stays usable until the tape is reallocated to grow, which is
+ * detected by btm_get_gen() no longer returning @gen.
+ */
+typedef struct btm_view {
+	const char *cells;
+	int start;
+	int end;
+	unsigned long gen;
+} BTMView;
+
 /*
  * returns a new BTM object.  the new BTM has an empty instruction table
  * (size = 0) and an all-zero tape, its head position is 0 and its state
@@ -95,24 +137,80 @@ int btm_set_instr(BTM *btm, int q, char s, int instr);
  * copies a char array @tape to the range of @btm's tape specified by
  * @start (inclusive) and @end (exclusive), and returns 0 on success.
  * the caller shall guarantee @tape is a char array of '0's and '1's
- * that's at least @end - @start long.  returns a non-zero value and
- * sets errno for invalid arguments (@start > @end or @tape is NULL)
- * or if reallocation of @btm's tape fails.
+ * that's at least @end - @start long.  any cells between the range, the
+ * head and the cells written before are written '0' so that the written
+ * cells stay contiguous.  returns a non-zero value and sets errno for
+ * invalid arguments (@start > @end or @tape is NULL) or if reallocation
+ * of @btm's tape fails.
  */
 int btm_set_tape(BTM *btm, int start, int end, const char *tape);
 
+/*
+ * allocates @btm's tape from @start (inclusive) to @end (exclusive) in
+ * advance, so that running it for n steps with its head at h doesn't
+ * reallocate the tape as long as h - n and h + n are in the range.
+ * returns 0 on success, non-zero value and sets errno if @start > @end
+ * or reallocation fails.
+ */
+int btm_reserve_tape(BTM *btm, int start, int end);
+
+/*
+ * limits @btm's tape to @limit bytes, or lifts the limit if @limit is 0.
+ * a function that would grow the tape beyond the limit fails with errno
+ * set to ENOBUFS instead, except that a run stops short, after the
+ * steps that fit, and only fails if not even one step does.  the BTM is
+ * left as it was before the step that didn't fit, ready to be dumped or
+ * run again with a higher limit.  tape already allocated isn't freed.
+ */
+void btm_set_limit(BTM *btm, size_t limit);
+
 /*
  * runs @btm until it finishes or reaches the maximum of steps @nstep.
  * on success, returns the number of steps executed (0 if @btm has already
  * finished).  if @steps is not NULL, the instructions that are executed
  * are stored into the array it points to.  returns a negative value
- * and sets errno if @nstep < 0 or dynamically growing @btm's tape fails.
+ * and sets errno if @nstep < 0 or dynamically growing @btm's tape fails
+ * (see btm_set_limit()).
  */
 long long btm_run(BTM *btm, long long nstep, int *steps);
 
+/*
+ * runs @btm like btm_run() but stops before executing an instruction
+ * not yet marked as seen, i.e., that of state q and symbol s with
+ * @seen[q * 2 + (s == '1')] 0 rather than 1.  @seen is ignored if NULL.
+ * a BTM that has stopped this way is still running and about to execute
+ * that instruction.
+ */
+long long btm_run_seen(BTM *btm, long long nstep, int *steps, const char *seen);
+
+/*
+ * events btm_run_until() can stop at:
+ *
+ * BTM_EV_LEFT  - the head moved onto a cell left of all cells written so far
+ * BTM_EV_RIGHT - the head moved onto a cell right of all cells written so far
+ * BTM_EV_SLOT  - the BTM is about to execute a given instruction
+ */
+#define BTM_EV_LEFT        1 << 0
+#define BTM_EV_RIGHT       1 << 1
+#define BTM_EV_SLOT        1 << 2
+
+/*
+ * runs @btm like btm_run() but stops early after a step that causes
+ * one of the events in the mask @events.  for BTM_EV_SLOT, the
+ * instruction is the one for state @q and symbol @s, or either symbol
+ * if @s is '\0'.  the event is stored into the int pointed to by @event
+ * (0 if none occurred) unless @event is NULL.  returns the number of
+ * steps executed, or a negative value with errno set as btm_run() does.
+ * a new leftmost or rightmost cell is recognized as one that has never
+ * been written to, so the events are only meaningful while the written
+ * range of the tape is contiguous and contains the head.
+ */
+long long btm_run_until(BTM *btm, long long nstep, int events, int q, char s, int *event);
+
 /*
  * resets @btm. that is, clears its tape, rewinds its head position to
- * 0 and sets the state to 0.
+ * 0 and sets the state to 0.  only the cells written are cleared, so
+ * it takes time in proportion to their number.
  */
 void btm_reset(BTM *btm);
 
@@ -157,10 +255,78 @@ char *btm_get_tape(const BTM *btm, int start, int end);
  * btm_set_tape() or by running the BTM).  the start (inclusive) and
  * end (exclusive) of the range are stored into the ints pointed to by
  * @start and @end, respectively.  @start or @end may be NULL and the
- * corresponding result won't be stored.
+ * corresponding result won't be stored.  the range is kept up to date
+ * as the tape is written, so it costs nothing to ask.
  */
 void btm_get_range(const BTM *btm, int *start, int *end);
 
+/*
+ * returns the number of '1's on @btm's tape.  the count is kept up to
+ * date as the tape is written, so it costs nothing to ask.
+ */
+int btm_get_ones(const BTM *btm);
+
+/*
+ * resets @btm and sets its tape, head and state as specified by the
+ * configuration @str, which has the form "LEFT(Q)RIGHT": LEFT and RIGHT
+ * are strings of '0's and '1's, the last cell of LEFT is the one under
+ * the head (at index 0) and Q is the state.  returns 0 on success,
+ * non-zero value and sets errno if @str isn't a valid configuration
+ * for @btm's instruction table or growing the tape fails.
+ */
+int btm_conf_load(BTM *btm, const char *str);
+
+/*
+ * writes @btm's configuration, as accepted by btm_conf_load(), into
+ * @buf, which is @n bytes long, like btm_table_dump_into().  the
+ * configuration covers the range of the tape that has been written to
+ * and the head position.  returns the length of the whole string.
+ */
+int btm_conf_dump_into(const BTM *btm, char *buf, size_t n);
+
+/*
+ * fills in @view with a view of the range of @btm's tape that has been
+ * written to.  nothing is copied.
+ */
+void btm_get_view(const BTM *btm, BTMView *view);
+
+/*
+ * returns the generation of @btm's tape storage, which changes whenever
+ * the tape is reallocated and views of it become invalid.
+ */
+unsigned long btm_get_gen(const BTM *btm);
+
+/*
+ * returns the number of bytes allocated for @btm's tape and instruction
+ * table.  as neither ever shrinks, it's also the most @btm has held.
+ */
+size_t btm_get_mem(const BTM *btm);
+
+/*
+ * packs the piece of @btm's tape from @start (inclusive) to @end
+ * (exclusive) into @bits, one bit per cell (1 for '1'), the cell at
+ * @start going to the least significant bit of the first byte.  @bits
+ * must be at least (@end - @start + 7) / 8 bytes long; the unused high
+ * bits of the last byte are cleared.  returns a non-zero value and sets
+ * errno if @start > @end.
+ */
+int btm_get_bits(const BTM *btm, int start, int end, unsigned char *bits);
+
+/*
+ * the inverse of btm_get_bits(): sets the cells of @btm's tape from
+ * @start (inclusive) to @end (exclusive) from the bit-packed @bits and
+ * returns 0 on success.  returns a non-zero value and sets errno if
+ * @start > @end or reallocation of @btm's tape fails.
+ */
+int btm_set_bits(BTM *btm, int start, int end, const unsigned char *bits);
+
+/*
+ * stores @btm's counters into @st and returns 0.  returns a non-zero
+ * value and sets errno to ENOTSUP if the library is compiled without
+ * BTM_STATS.
+ */
+int btm_get_stats(const BTM *btm, struct btm_stats *st);
+
 /*
  * loads the instruction table specified by @str into @btm and returns
  * 0 on success.  returns NULL and sets errno if @str doesn't contain a
@@ -169,6 +335,15 @@ void btm_get_range(const BTM *btm, int *start, int *end);
  */
 int btm_table_load(BTM *btm, const char *str);
 
+/*
+ * sets @btm's instruction table to the @size * 2 instructions @instrs,
+ * which are in the order btm_get_instr() gives them for states 0, 1, ...
+ * and symbols '0' and '1'.  returns 0 on success, non-zero value and
+ * sets errno if an instruction isn't valid for a table of @size states
+ * or memory allocation fails.
+ */
+int btm_table_set(BTM *btm, int size, const int *instrs);
+
 /*
  * returns the string representation of @btm's instruction table.
  * memory for the string is allocated with malloc(3) and the caller is
@@ -176,6 +351,39 @@ int btm_table_load(BTM *btm, const char *str);
  */
 char *btm_table_dump(const BTM *btm);
 
+/*
+ * writes the string representation of @btm's instruction table into
+ * @buf, which is @n bytes long, like snprintf(3): at most @n bytes
+ * including the terminating null byte are written, and the length of
+ * the whole string is returned, so a return value not less than @n
+ * means the output was truncated.  returns a negative value and sets
+ * errno if @btm's instruction table is empty.
+ */
+int btm_table_dump_into(const BTM *btm, char *buf, size_t n);
+
+/*
+ * writes a binary record of @btm's instruction table, or of its first
+ * @len instructions if @len is less than the whole table's length, to
+ * @fp.  a record consists of a byte holding the size, a byte holding
+ * the number of instructions, one byte per instruction (the instruction
+ * plus 4, so FIN is 0) and a varint (7 bits per byte, least significant
+ * first) of @nstep * 4 + @kind, @kind being one of the BTM_REC_* values.
+ * returns 0 on success, non-zero value and sets errno if the record
+ * can't represent @btm (more than 63 states) or @nstep (2^62 or more),
+ * or writing fails.
+ */
+int btm_rec_write(const BTM *btm, int len, int kind, long long nstep, FILE *fp);
+
+/*
+ * reads a binary record written by btm_rec_write() from @fp into @btm,
+ * whose instruction table is set to the recorded one with any missing
+ * instructions being FIN.  the number of recorded instructions, the
+ * kind and the step count are stored into the ints pointed to by @len,
+ * @kind and @nstep, respectively.  returns 1 on success, 0 at the end
+ * of file, and a negative value and sets errno on failure.
+ */
+int btm_rec_read(BTM *btm, int *len, int *kind, long long *nstep, FILE *fp);
+
 /*
  * returns a new iterator for BTMs of size @size.  @flags is a bitwise
  * ORed combination of zero or more of the BTM_* flags described above.
@@ -190,8 +398,9 @@ char *btm_table_dump(const BTM *btm);
  * or memory allocation for the new BTMIter object fails, or @prefix,
  * if given, doesn't contain a valid specification of an instruction
  * table prefix.  if BTM_RANDOM is in @flags, /dev/urandom is read to
- * seed a random number generator, so failure may also occur if the
- * reading fails.
+ * seed the iterator's own random number generator, so failure may also
+ * occur if the reading fails.  iterators don't share any state, so
+ * different threads can use different iterators concurrently.
  */
 BTMIter *btm_iter_new(int size, int flags, const char *prefix, int len);
 
@@ -208,10 +417,44 @@ void btm_iter_del(BTMIter *it);
  */
 BTMIter *btm_iter_incr(BTMIter *it);
 
+/*
+ * writes the state of iterator @it to @fp as a line of text, from which
+ * btm_iter_load() can recreate an iterator that continues from the same
+ * position.  returns 0 on success, non-zero value and sets errno if
+ * writing to @fp fails.
+ */
+int btm_iter_save(const BTMIter *it, FILE *fp);
+
+/*
+ * reads an iterator state written by btm_iter_save() from @fp and
+ * returns a new iterator at the saved position.  if BTM_RANDOM is in
+ * the saved flags, the random number generator is seeded anew, so the
+ * subsequent BTMs won't be the ones the saved iterator would produce.
+ * returns NULL and sets errno if @fp doesn't contain a valid iterator
+ * state or allocation fails.
+ */
+BTMIter *btm_iter_load(FILE *fp);
+
+/*
+ * returns the number of instruction tables (or prefixes) a new iterator
+ * created with the same arguments as @it visits, without visiting them,
+ * or 0 if @it has iterated past the last one.  returns -1 and sets
+ * errno if BTM_RANDOM is in @it's flags or memory allocation fails.
+ */
+double btm_iter_count(const BTMIter *it);
+
 /*
  * returns a reference of @it's internal BTM object if @it hasn't iterated
  * past the last one, returns NULL otherwise.
  */
 BTM *btm_iter_deref(const BTMIter *it);
 
+/*
+ * returns the lowest index, q * 2 + (s == '1'), of the instructions
+ * the last call of btm_iter_incr() on @it may have changed, or 0 if
+ * there was none yet or BTM_RANDOM is in @it's flags.  the BTMs before
+ * and after the call agree on all lower instructions.
+ */
+int btm_iter_changed(const BTMIter *it);
+
 #endif
@@ -0,0 +1,268 @@
+#define _POSIX_C_SOURCE 200809L /* for fcntl(), ftruncate() and mmap() */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+#define NWAY   4
+#define KEYLEN (CACHE_MAXSIZE * 2 / 8)
+
+static const char magic[8] = "BTMOC1\n";
+
+struct header {
+	char magic[8];
+	uint64_t nbucket;
+	uint64_t tick;
+	uint64_t pad[5];
+};
+
+/*
+ * @seq is a sequence lock: it's odd while the entry is being written and
+ * zero if it never was.  readers copy the entry and retry elsewhere if
+ * @seq changed meanwhile.  @tick tells the age of the entry.
+ */
+struct entry {
+	uint32_t seq;
+	uint32_t sig;
+	uint64_t tick;
+	int64_t nstep;
+	int64_t verdict;
+	uint64_t key[KEYLEN];
+};
+
+struct cache {
+	int fd;
+	size_t mapsize;
+	struct header *hdr;
+	struct entry *ent;
+};
+
+static int mkkey(const BTM *btm, uint64_t *key);
+static uint64_t hash(const uint64_t *key, unsigned sig);
+
+/*
+ * the key is the instruction table with one byte per instruction, FIN
+ * being 0xff and absent states 0xfe.
+ */
+int
+mkkey(const BTM *btm, uint64_t *key)
+{
+	unsigned char b[KEYLEN * 8];
+	int n, q, instr;
+
+	if ((n = btm_get_size(btm)) > CACHE_MAXSIZE)
+		return -1;
+	memset(b, 0xfe, sizeof(b));
+	for (q = 0; q < n; ++q) {
+		instr = btm_get_instr(btm, q, '0');
+		b[q * 2] = instr == BTM_FIN ? 0xff : instr;
+		instr = btm_get_instr(btm, q, '1');
+		b[q * 2 + 1] = instr == BTM_FIN ? 0xff : instr;
+	}
+	memcpy(key, b, sizeof(b));
+	return 0;
+}
+
+uint64_t
+hash(const uint64_t *key, unsigned sig)
+{
+	const unsigned char *p = (const unsigned char *)key;
+	uint64_t h;
+	int i;
+
+	h = 14695981039346656037ULL ^ sig;
+	for (i = 0; i < KEYLEN * 8; ++i)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+unsigned
+cachesig(const char *opts)
+{
+	unsigned h;
+
+	for (h = 2166136261U; *opts; ++opts)
+		h = (h ^ (unsigned char)*opts) * 16777619U;
+	return h;
+}
+
+/*
+ * the file is created and its header checked under a lock on its first
+ * byte, so that processes starting at the same time agree on its size.
+ * every process using the cache holds a read lock on its second byte.
+ * a process that can lock it for writing instead is the only user, so
+ * the entries still odd were left by writers that died, and they are
+ * emptied before the lock is downgraded.
+ */
+struct cache *
+cacheopen(const char *path, long nslot)
+{
+	struct cache *c;
+	struct header hdr;
+	struct flock fl, ul;
+	struct stat st;
+	uint64_t i;
+	int err;
+
+	if (!(c = calloc(1, sizeof(*c))))
+		return NULL;
+	if ((c->fd = open(path, O_RDWR|O_CREAT, 0666)) < 0) {
+		free(c);
+		return NULL;
+	}
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_len = 1;
+	ul = fl;
+	ul.l_start = 1;
+	while (fcntl(c->fd, F_SETLKW, &fl))
+		if (errno != EINTR)
+			goto fail;
+	if (fstat(c->fd, &st))
+		goto fail;
+	if (!st.st_size) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, magic, sizeof(magic));
+		hdr.nbucket = nslot > NWAY ? nslot / NWAY : 1;
+		st.st_size = sizeof(hdr) + hdr.nbucket * NWAY * sizeof(struct entry);
+		if (ftruncate(c->fd, st.st_size)
+		|| pwrite(c->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+			goto fail;
+	} else if (pread(c->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+	|| memcmp(hdr.magic, magic, sizeof(magic)) || !hdr.nbucket
+	|| st.st_size != sizeof(hdr) + hdr.nbucket * NWAY * sizeof(struct entry)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	c->mapsize = st.st_size;
+	c->hdr = mmap(NULL, c->mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, c->fd, 0);
+	if (c->hdr == MAP_FAILED)
+		goto fail;
+	c->ent = (struct entry *)(c->hdr + 1);
+	if (!fcntl(c->fd, F_SETLK, &ul)) {
+		for (i = 0; i < c->hdr->nbucket * NWAY; ++i)
+			if (c->ent[i].seq & 1)
+				__atomic_store_n(&c->ent[i].seq, 0, __ATOMIC_RELAXED);
+	}
+	ul.l_type = F_RDLCK;
+	if (fcntl(c->fd, F_SETLK, &ul)) {
+		munmap(c->hdr, c->mapsize);
+		goto fail;
+	}
+	fl.l_type = F_UNLCK;
+	fcntl(c->fd, F_SETLK, &fl);
+	return c;
+fail:
+	err = errno;
+	close(c->fd);
+	free(c);
+	errno = err;
+	return NULL;
+}
+
+void
+cacheclose(struct cache *c)
+{
+	if (!c)
+		return;
+	munmap(c->hdr, c->mapsize);
+	close(c->fd);
+	free(c);
+}
+
+int
+cacheget(struct cache *c, const BTM *btm, unsigned sig, int *verdict, long long *nstep)
+{
+	uint64_t key[KEYLEN];
+	struct entry *e;
+	uint32_t seq;
+	int64_t v, n;
+	int i, k, match;
+
+	if (mkkey(btm, key))
+		return 0;
+	e = &c->ent[hash(key, sig) % c->hdr->nbucket * NWAY];
+	for (i = 0; i < NWAY; ++i, ++e) {
+		seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		if (!seq || seq & 1)
+			continue;
+		match = __atomic_load_n(&e->sig, __ATOMIC_RELAXED) == sig;
+		for (k = 0; k < KEYLEN; ++k)
+			match &= __atomic_load_n(&e->key[k], __ATOMIC_RELAXED) == key[k];
+		v = __atomic_load_n(&e->verdict, __ATOMIC_RELAXED);
+		n = __atomic_load_n(&e->nstep, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (!match || __atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+		*verdict = v;
+		*nstep = n;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * an entry with the same key is overwritten in preference to an empty
+ * one, which is taken in preference to the oldest one.  a writer takes
+ * the entry by making its sequence number odd, so writers never collide.
+ */
+void
+cacheput(struct cache *c, const BTM *btm, unsigned sig, int verdict, long long nstep)
+{
+	uint64_t key[KEYLEN];
+	struct entry *e, *victim;
+	uint64_t tick, oldest;
+	uint32_t seq;
+	int i, k, match;
+
+	if (mkkey(btm, key))
+		return;
+	e = &c->ent[hash(key, sig) % c->hdr->nbucket * NWAY];
+	victim = NULL;
+	oldest = UINT64_MAX;
+	for (i = 0; i < NWAY; ++i, ++e) {
+		seq = __atomic_load_n(&e->seq, __ATOMIC_RELAXED);
+		if (seq & 1)
+			continue;
+		if (!seq) {
+			if (oldest) {
+				victim = e;
+				oldest = 0;
+			}
+			continue;
+		}
+		match = __atomic_load_n(&e->sig, __ATOMIC_RELAXED) == sig;
+		for (k = 0; k < KEYLEN; ++k)
+			match &= __atomic_load_n(&e->key[k], __ATOMIC_RELAXED) == key[k];
+		if (match) {
+			victim = e;
+			break;
+		}
+		if ((tick = __atomic_load_n(&e->tick, __ATOMIC_RELAXED)) < oldest) {
+			victim = e;
+			oldest = tick;
+		}
+	}
+	if (!victim)
+		return;
+	seq = __atomic_load_n(&victim->seq, __ATOMIC_RELAXED);
+	if (seq & 1 || !__atomic_compare_exchange_n(&victim->seq, &seq, seq + 1, 0,
+	__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		return;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	tick = __atomic_add_fetch(&c->hdr->tick, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->sig, sig, __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->tick, tick, __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->verdict, verdict, __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->nstep, nstep, __ATOMIC_RELAXED);
+	for (k = 0; k < KEYLEN; ++k)
+		__atomic_store_n(&victim->key[k], key[k], __ATOMIC_RELAXED);
+	__atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
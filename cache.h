@@ -0,0 +1,46 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include "btm.h"
+
+/*
+ * a fixed-size file of outcomes of BTMs, keyed by instruction table and
+ * a signature of the options the outcome depends on.  the file is
+ * mapped into memory and can be shared by concurrent threads and
+ * processes without locking.  when a bucket is full, the entry written
+ * longest ago is evicted.  instruction tables of more than CACHE_MAXSIZE
+ * states are never cached.
+ */
+#define CACHE_MAXSIZE 16
+
+struct cache;
+
+/*
+ * opens the cache at @path, creating it with room for @nslot entries if
+ * it doesn't exist.  returns NULL and sets errno on failure, EINVAL if
+ * the file isn't a cache.  an entry that a process died writing stays
+ * unusable while other processes have the cache open, and is reclaimed
+ * by the next process to open it alone.
+ */
+struct cache *cacheopen(const char *path, long nslot);
+
+void cacheclose(struct cache *c);
+
+/*
+ * returns a signature for the options described by the string @opts.
+ */
+unsigned cachesig(const char *opts);
+
+/*
+ * looks up the outcome of @btm under signature @sig.  returns 1 and
+ * stores the outcome in @verdict and @nstep if it's found, 0 otherwise.
+ */
+int cacheget(struct cache *c, const BTM *btm, unsigned sig, int *verdict, long long *nstep);
+
+/*
+ * records the outcome of @btm under signature @sig.  the record is
+ * silently dropped if another writer holds every candidate entry.
+ */
+void cacheput(struct cache *c, const BTM *btm, unsigned sig, int verdict, long long nstep);
+
+#endif
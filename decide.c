@@ -0,0 +1,300 @@
+#include <limits.h>
+#include <stdlib.h>
+
+#include "btm.h"
+#include "decide.h"
+#include "util.h"
+
+/*
+ * tcycler() keeps the last TC_NREC records (steps where the head reached
+ * a new cell) of every state and side, with the TC_SPAN cells behind the
+ * head.
+ */
+#define TC_NREC 4
+#define TC_SPAN 1024
+
+struct record {
+	long long t;
+	int head;
+	int lo;
+	int len;
+	char cells[TC_SPAN];
+};
+
+/*
+ * ncycler() runs the BTM NC_MINCHUNK steps at first and twice as many
+ * each time after, up to NC_MAXCHUNK.  it keeps the last time the head
+ * reached a new cell in every state and on either side.
+ */
+#define NC_MINCHUNK 16
+#define NC_MAXCHUNK 4096
+
+struct escape {
+	long long t;
+	int head;
+	int ones;
+};
+
+static int samecells(const BTM *btm, const char *tape, int start, int end);
+static char cell(const BTMView *v, int i);
+static int translated(const BTM *btm, const struct record *r, const int *heads, long long t, int h);
+static void onesrange(const BTM *btm, long long *lo, long long *hi);
+
+/*
+ * compares @btm's tape with @tape, which holds the cells from @start to
+ * @end of a tape blank elsewhere.
+ */
+int
+samecells(const BTM *btm, const char *tape, int start, int end)
+{
+	int i, j, x;
+
+	btm_get_range(btm, &i, &j);
+	for (x = MIN(i, start); x < MAX(j, end); ++x)
+		if (btm_get_cell(btm, x) != (x >= start && x < end ? tape[x - start] : '0'))
+			return 0;
+	return 1;
+}
+
+int
+cycler(BTM *btm, long long nstep, long long *n)
+{
+	char *tape;
+	long long m;
+	int q, h, i, j, ev;
+	char s;
+
+	*n = 0;
+	if ((q = btm_get_state(btm)) < 0)
+		return 0;
+	h = btm_get_head(btm);
+	s = btm_get_cell(btm, h);
+	btm_get_range(btm, &i, &j);
+	if (!(tape = btm_get_tape(btm, i, j)))
+		return -1;
+	while (*n < nstep) {
+		if ((m = btm_run_until(btm, nstep - *n, BTM_EV_SLOT, q, s, &ev)) < 0) {
+			free(tape);
+			return -1;
+		}
+		*n += m;
+		if (!ev)
+			break;
+		if (btm_get_head(btm) == h && samecells(btm, tape, i, j)) {
+			free(tape);
+			return 1;
+		}
+	}
+	free(tape);
+	return 0;
+}
+
+char
+cell(const BTMView *v, int i)
+{
+	return i >= v->start && i < v->end ? v->cells[i - v->start] : '0';
+}
+
+/*
+ * the head has reached a new cell @h at step @t in the same state as at
+ * record @r, on the same side.  the steps in between only read cells
+ * between the farthest the head went back, found in @heads, and @r's
+ * head.  if these cells are the same around @h now, the steps repeat.
+ */
+int
+translated(const BTM *btm, const struct record *r, const int *heads, long long t, int h)
+{
+	long long i;
+	int d, m, x;
+
+	d = h - r->head;
+	m = r->head;
+	for (i = r->t; i <= t; ++i)
+		m = d > 0 ? MIN(m, heads[i]) : MAX(m, heads[i]);
+	if (m < r->lo || m >= r->lo + r->len)
+		return 0;
+	for (x = MIN(m, r->head); x <= MAX(m, r->head); ++x)
+		if (r->cells[x - r->lo] != btm_get_cell(btm, x + d))
+			return 0;
+	return 1;
+}
+
+/*
+ * the BTM is run a step at a time to follow the head, so @nstep should
+ * be kept moderate.
+ */
+int
+tcycler(BTM *btm, long long nstep, long long *n)
+{
+	struct record *recs, *r;
+	BTMView v;
+	int *heads;
+	long long t;
+	int lo, hi, h, q, side, found, k, x;
+
+	*n = 0;
+	if ((q = btm_get_state(btm)) < 0)
+		return 0;
+	if (!(recs = calloc(btm_get_size(btm) * 2 * TC_NREC, sizeof(*recs))))
+		return -1;
+	if (!(heads = malloc((nstep + 1) * sizeof(*heads)))) {
+		free(recs);
+		return -1;
+	}
+	h = btm_get_head(btm);
+	btm_get_range(btm, &lo, &hi);
+	lo = MIN(lo, h);
+	hi = MAX(hi - 1, h);
+	heads[0] = h;
+	found = 0;
+	for (t = 0; t < nstep && !found;) {
+		if (btm_run(btm, 1, NULL) < 0) {
+			found = -1;
+			break;
+		}
+		++t;
+		if ((q = btm_get_state(btm)) < 0)
+			break;
+		heads[t] = h = btm_get_head(btm);
+		if (h >= lo && h <= hi)
+			continue;
+		side = h > hi;
+		if (side)
+			hi = h;
+		else
+			lo = h;
+		r = &recs[(q * 2 + side) * TC_NREC];
+		for (k = 0; k < TC_NREC && r[k].len && !found; ++k)
+			found = translated(btm, &r[k], heads, t, h);
+		/* replace the oldest record */
+		for (k = 1, x = 0; k < TC_NREC; ++k)
+			if (r[k].t < r[x].t)
+				x = k;
+		r += x;
+		r->t = t;
+		r->head = h;
+		r->lo = side ? MAX(lo, h - TC_SPAN + 1) : h;
+		r->len = side ? h - r->lo + 1 : MIN(hi, h + TC_SPAN - 1) - h + 1;
+		btm_get_view(btm, &v);
+		for (x = 0; x < r->len; ++x)
+			r->cells[x] = cell(&v, r->lo + x);
+	}
+	free(heads);
+	free(recs);
+	*n = t;
+	return found;
+}
+
+int
+nonerasing(const BTM *btm)
+{
+	int q, instr;
+
+	for (q = 0; q < btm_get_size(btm); ++q) {
+		instr = btm_get_instr(btm, q, '1');
+		if (instr != BTM_FIN && BTM_INSTR_S(instr) != '1')
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * stores the positions of the leftmost and rightmost '1's on @btm's tape
+ * into @lo and @hi, which are LLONG_MAX and LLONG_MIN without a '1'.
+ */
+void
+onesrange(const BTM *btm, long long *lo, long long *hi)
+{
+	BTMView v;
+	int i, j;
+
+	btm_get_view(btm, &v);
+	for (i = 0; i < v.end - v.start && v.cells[i] != '1'; ++i)
+		;
+	for (j = v.end - v.start; j > i && v.cells[j - 1] != '1'; --j)
+		;
+	*lo = i < j ? v.start + i : LLONG_MAX;
+	*hi = i < j ? v.start + j - 1 : LLONG_MIN;
+}
+
+/*
+ * a non-erasing BTM never turns a '1' back into '0', so its tape stays
+ * the same for as long as the number of '1's does.  the head only visits
+ * the cells written by then and those next to them meanwhile, so once
+ * the BTM has spent more steps than it has states times these cells,
+ * some configuration has recurred.
+ *
+ * a BTM that instead heads away from the '1's for good keeps reaching
+ * new cells.  while it does without writing a '1', it's run a step at a
+ * time, and reaching a new cell in the same state and on the same side
+ * as before shows it if the head didn't get back as far as a '1' in
+ * between, which the number of steps bounds: only '0's were read, so
+ * the same steps repeat further away.
+ */
+int
+ncycler(BTM *btm, long long nstep, long long *n, const char *seen)
+{
+	struct escape *esc, *e;
+	long long t, m, k, lim, lo, hi;
+	int ones, known, start, end, i, j, h, grew, found;
+
+	*n = 0;
+	if (btm_get_state(btm) < 0 || !nonerasing(btm))
+		return 0;
+	if (!(esc = malloc(btm_get_size(btm) * 2 * sizeof(*esc))))
+		return -1;
+	for (i = 0; i < btm_get_size(btm) * 2; ++i)
+		esc[i].t = -1;
+	known = -1;
+	lo = hi = 0;
+	t = 0;
+	ones = btm_get_ones(btm);
+	btm_get_range(btm, &start, &end);
+	m = NC_MINCHUNK;
+	found = 0;
+	while (*n < nstep && !found) {
+		btm_get_range(btm, &i, &j);
+		grew = i < start || j > end;
+		if (btm_get_ones(btm) != ones) {
+			t = *n;
+			ones = btm_get_ones(btm);
+			grew = 0;
+		} else if (*n - t >= (long long)btm_get_size(btm) * (j - i + 2)) {
+			found = 1;
+			break;
+		}
+		start = i;
+		end = j;
+		lim = *n + MIN(m, nstep - *n);
+		m = MIN(m * 2, NC_MAXCHUNK);
+		while (*n < lim && !found) {
+			if ((k = btm_run_seen(btm, grew ? 1 : lim - *n, NULL, seen)) < 0) {
+				found = -1;
+				break;
+			}
+			*n += k;
+			if (!k || btm_get_state(btm) < 0)
+				break;
+			if (!grew)
+				continue;
+			btm_get_range(btm, &i, &j);
+			if ((h = btm_get_head(btm)) >= i && h < j)
+				continue;
+			e = &esc[btm_get_state(btm) * 2 + (h >= j)];
+			if (e->t >= 0 && e->ones == btm_get_ones(btm)) {
+				if (known != e->ones) {
+					onesrange(btm, &lo, &hi);
+					known = e->ones;
+				}
+				found = h >= j ? e->head - (*n - e->t) > hi : e->head + (*n - e->t) < lo;
+			}
+			e->t = *n;
+			e->head = h;
+			e->ones = btm_get_ones(btm);
+		}
+		if (*n < lim && found <= 0)
+			break;
+	}
+	free(esc);
+	return found;
+}
@@ -0,0 +1,43 @@
+#ifndef DECIDE_H_
+#define DECIDE_H_
+
+#include "btm.h"
+
+/*
+ * deciders proving that a BTM never finishes.  each runs @btm from its
+ * current configuration for at most @nstep steps and stores the number
+ * of steps executed into the long long pointed to by @n.  they return
+ * 1 if the BTM is shown to run forever, 0 if not, and -1 with errno set
+ * if memory allocation fails or the tape reaches its limit, the steps
+ * executed still being counted.
+ */
+
+/*
+ * watches for the configuration at the start to recur.
+ */
+int cycler(BTM *btm, long long nstep, long long *n);
+
+/*
+ * watches for the head to reach a new cell in the same state and with
+ * the same surroundings as when it reached a new cell on the same side
+ * before, the BTM then repeating the steps in between forever, shifted
+ * along the tape.
+ */
+int tcycler(BTM *btm, long long nstep, long long *n);
+
+/*
+ * tells whether @btm never turns a '1' back into '0'.
+ */
+int nonerasing(const BTM *btm);
+
+/*
+ * for non-erasing BTMs only, watches for a configuration to recur
+ * before another '1' is written, or for the head to leave the '1's
+ * behind for good.  neither is ever mistaken, though either may take
+ * some more steps to be seen.  returns 0 at once for other BTMs.  like
+ * btm_run_seen(), stops before an instruction not marked in @seen
+ * unless @seen is NULL.
+ */
+int ncycler(BTM *btm, long long nstep, long long *n, const char *seen);
+
+#endif
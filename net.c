@@ -0,0 +1,195 @@
+#define _POSIX_C_SOURCE 200809L /* for getaddrinfo() */
+#include <errno.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "net.h"
+
+#define INIT_LINEBUF_SZ 4096
+
+static int unixaddr(const char *path, struct sockaddr_un *sun);
+static int netopen(const char *addr, int listening);
+
+int
+unixaddr(const char *path, struct sockaddr_un *sun)
+{
+	if (strlen(path) >= sizeof(sun->sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	strcpy(sun->sun_path, path);
+	return 0;
+}
+
+/*
+ * an address containing a slash is the path of a Unix domain socket,
+ * otherwise it is taken as host:port, where an empty host means any
+ * local address when listening and localhost when connecting.
+ */
+int
+netopen(const char *addr, int listening)
+{
+	struct sockaddr_un sun;
+	struct addrinfo hints, *res, *ai;
+	char *host, *port;
+	int fd, e, one;
+
+	if (strchr(addr, '/')) {
+		if (unixaddr(addr, &sun) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			return -1;
+		if (listening) {
+			unlink(addr);
+			e = bind(fd, (struct sockaddr *)&sun, sizeof(sun)) || listen(fd, SOMAXCONN);
+		} else {
+			e = connect(fd, (struct sockaddr *)&sun, sizeof(sun));
+		}
+		if (e) {
+			e = errno;
+			close(fd);
+			errno = e;
+			return -1;
+		}
+		return fd;
+	}
+	if (!(host = strdup(addr)))
+		return -1;
+	if (!(port = strrchr(host, ':'))) {
+		free(host);
+		errno = EINVAL;
+		return -1;
+	}
+	*port++ = '\0';
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	if ((e = getaddrinfo(*host ? host : NULL, port, &hints, &res))) {
+		free(host);
+		errno = e == EAI_SYSTEM ? errno : EADDRNOTAVAIL;
+		return -1;
+	}
+	free(host);
+	fd = -1;
+	for (ai = res; ai; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0)
+			continue;
+		if (listening) {
+			one = 1;
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (!bind(fd, ai->ai_addr, ai->ai_addrlen) && !listen(fd, SOMAXCONN))
+				break;
+		} else if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+			break;
+		}
+		e = errno;
+		close(fd);
+		errno = e;
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+int
+netlisten(const char *addr)
+{
+	return netopen(addr, 1);
+}
+
+int
+netconnect(const char *addr)
+{
+	return netopen(addr, 0);
+}
+
+int
+netsend(int fd, const char *fmt, ...)
+{
+	char buf[256], *p, *s;
+	va_list ap;
+	ssize_t n;
+	int l;
+
+	va_start(ap, fmt);
+	l = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (l < 0)
+		return -1;
+	p = buf;
+	if (l >= sizeof(buf)) {
+		if (!(p = malloc(l + 1)))
+			return -1;
+		va_start(ap, fmt);
+		vsnprintf(p, l + 1, fmt, ap);
+		va_end(ap);
+	}
+	for (s = p; l > 0; s += n, l -= n) {
+		if ((n = write(fd, s, l)) < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			break;
+		}
+	}
+	if (p != buf)
+		free(p);
+	return l > 0 ? -1 : 0;
+}
+
+ssize_t
+lbfill(struct linebuf *lb, int fd)
+{
+	char *p;
+	size_t cap;
+	ssize_t n;
+
+	if (lb->off) {
+		memmove(lb->buf, lb->buf + lb->off, lb->len - lb->off);
+		lb->len -= lb->off;
+		lb->off = 0;
+	}
+	if (lb->len == lb->cap) {
+		cap = lb->cap ? lb->cap * 2 : INIT_LINEBUF_SZ;
+		if (!(p = realloc(lb->buf, cap)))
+			return -1;
+		lb->buf = p;
+		lb->cap = cap;
+	}
+	do
+		n = read(fd, lb->buf + lb->len, lb->cap - lb->len);
+	while (n < 0 && errno == EINTR);
+	if (n > 0)
+		lb->len += n;
+	return n;
+}
+
+char *
+lbline(struct linebuf *lb)
+{
+	char *p, *s;
+
+	if (!lb->buf)
+		return NULL;
+	s = lb->buf + lb->off;
+	if (!(p = memchr(s, '\n', lb->len - lb->off)))
+		return NULL;
+	*p = '\0';
+	lb->off = p + 1 - lb->buf;
+	return s;
+}
+
+void
+lbfree(struct linebuf *lb)
+{
+	free(lb->buf);
+	memset(lb, 0, sizeof(*lb));
+}
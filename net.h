@@ -0,0 +1,24 @@
+#ifndef NET_H_
+#define NET_H_
+
+#include <sys/types.h> /* for ssize_t */
+
+/*
+ * a growable buffer that accumulates bytes read from a file descriptor
+ * and hands them out line by line.
+ */
+struct linebuf {
+	char *buf;
+	size_t len;
+	size_t off;
+	size_t cap;
+};
+
+int netlisten(const char *addr);
+int netconnect(const char *addr);
+int netsend(int fd, const char *fmt, ...);
+ssize_t lbfill(struct linebuf *lb, int fd);
+char *lbline(struct linebuf *lb);
+void lbfree(struct linebuf *lb);
+
+#endif
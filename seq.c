@@ -0,0 +1,66 @@
+#include "btm.h"
+#include "seq.h"
+#include "util.h"
+
+int
+repeating(const int *a, int n, int minrep)
+{
+	int instr;
+	int p, q, m, i, j;
+
+	q = n / minrep;
+	instr = a[0];
+	for (p = 1; p <= q; ++p) {
+		for (i = p; i < n; i += p)
+			if (a[i] != instr)
+				goto nextp;
+		for (i = p; i < n; i += p) {
+			m = MIN(p, n - i);
+			for (j = 1; j < m; ++j)
+				if (a[j] != a[i + j])
+					goto nextp;
+		}
+		return 1;
+nextp:;
+	}
+	return 0;
+}
+
+void
+dedup(int *a, int *n, int duplen)
+{
+	int i, j, k, m, p;
+
+	for (i = 0; i < *n - 1; ++i) {
+		m = MIN(duplen, *n - i);
+		for (p = 1; p <= m; ++p) {
+			j = i + p;
+			for (k = 0; k < p && a[i + k] == a[j + k]; ++k)
+				;
+			if (k == p)
+				break;
+		}
+		if (p > m)
+			continue;
+		j = i + p * 2;
+		for (k = p; k; --k)
+			a[j - k] = BTM_FIN;
+		while (j < *n) {
+			for (k = 0; k < p && a[i + k] == a[j + k]; ++k)
+				;
+			if (k < p)
+				break;
+			while (k--)
+				a[j++] = BTM_FIN;
+		}
+		i = j - 1;
+	}
+	for (i = j = 1;;) {
+		while (j < *n && a[j] == BTM_FIN)
+			++j;
+		if (j == *n)
+			break;
+		a[i++] = a[j++];
+	}
+	*n = i;
+}
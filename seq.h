@@ -0,0 +1,18 @@
+#ifndef SEQ_H_
+#define SEQ_H_
+
+/*
+ * returns non-zero if the sequence of instructions @a, @n long, consists
+ * of at least @minrep repetitions of a period (the last one possibly
+ * incomplete).
+ */
+int repeating(const int *a, int n, int minrep);
+
+/*
+ * collapses every run of consecutive repetitions of a subsequence at
+ * most @duplen long in the sequence of instructions @a into a single
+ * occurrence, in place, and updates the length pointed to by @n.
+ */
+void dedup(int *a, int *n, int duplen);
+
+#endif
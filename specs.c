@@ -0,0 +1,288 @@
+#define _POSIX_C_SOURCE 200809L /* for mmap() */
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "specs.h"
+
+/*
+ * a thread gets at least MINCHUNK bytes to parse.
+ */
+#define MINCHUNK (1L << 20)
+
+/*
+ * each thread parses a chunk of whole lines into arrays of its own,
+ * which are concatenated once all threads are done.  line numbers and
+ * offsets into the arrays are local to the chunk until then.
+ */
+struct chunk {
+	const char *map;
+	const char *start;
+	const char *end;
+	pthread_t tid;
+	long nline;
+	long n;
+	size_t cap;
+	struct spec *spec;
+	int *instrs;
+	size_t ninstr, instrcap;
+	unsigned char *bits;
+	size_t nbits, bitscap;
+	int err;
+};
+
+static int grow(void **p, size_t *cap, size_t need, size_t elsize);
+static int parseline(struct chunk *c, BTM *btm, char *str, size_t off);
+static void *parse(void *arg);
+
+int
+grow(void **p, size_t *cap, size_t need, size_t elsize)
+{
+	void *q;
+	size_t n;
+
+	if (need <= *cap)
+		return 0;
+	n = *cap ? *cap : 64;
+	while (n < need)
+		n *= 2;
+	if (!(q = realloc(*p, n * elsize)))
+		return -1;
+	*p = q;
+	*cap = n;
+	return 0;
+}
+
+/*
+ * parses the line @str found at offset @off of the file.  returns -1 only
+ * if memory allocation fails.
+ */
+int
+parseline(struct chunk *c, BTM *btm, char *str, size_t off)
+{
+	struct spec *s;
+	char *p, *q, *conf;
+	int i, j, k;
+
+	if (!str[strspn(str, " \t")])
+		return 0;
+	if (grow((void **)&c->spec, &c->cap, c->n + 1, sizeof(*c->spec)))
+		return -1;
+	s = &c->spec[c->n++];
+	memset(s, 0, sizeof(*s));
+	s->line = c->nline;
+	s->nstep = -1;
+	p = str;
+	k = 0;
+	if ((q = strstr(str, " continues after "))
+	&& sscanf(q, " continues after %lld steps: %n", &s->nstep, &k) == 1 && k)
+		p = q + k;
+	else
+		s->nstep = -1;
+	if ((conf = strchr(p, ',')))
+		*conf++ = '\0';
+	s->text = off + (p - str);
+	s->textlen = strlen(p);
+	if (btm_table_load(btm, p))
+		return errno == EINVAL ? 0 : -1;
+	btm_reset(btm);
+	if (conf && btm_conf_load(btm, conf))
+		return errno == EINVAL ? 0 : -1;
+	k = btm_get_size(btm);
+	if (grow((void **)&c->instrs, &c->instrcap, c->ninstr + k * 2, sizeof(*c->instrs)))
+		return -1;
+	s->instr = c->ninstr;
+	for (i = 0; i < k; ++i) {
+		c->instrs[c->ninstr++] = btm_get_instr(btm, i, '0');
+		c->instrs[c->ninstr++] = btm_get_instr(btm, i, '1');
+	}
+	if (conf) {
+		btm_get_range(btm, &i, &j);
+		if (grow((void **)&c->bits, &c->bitscap, c->nbits + (j - i + 7) / 8, 1))
+			return -1;
+		s->conf = 1;
+		s->state = btm_get_state(btm);
+		s->start = i;
+		s->end = j;
+		s->bits = c->nbits;
+		btm_get_bits(btm, i, j, c->bits + c->nbits);
+		c->nbits += (j - i + 7) / 8;
+	}
+	s->size = k;
+	return 0;
+}
+
+void *
+parse(void *arg)
+{
+	struct chunk *c = arg;
+	const char *p, *e;
+	char *buf;
+	size_t size;
+	BTM *btm;
+
+	if (!(btm = btm_new())) {
+		c->err = errno;
+		return NULL;
+	}
+	buf = NULL;
+	size = 0;
+	for (p = c->start; p < c->end; p = e + 1) {
+		if (!(e = memchr(p, '\n', c->end - p)))
+			e = c->end;
+		++c->nline;
+		if (grow((void **)&buf, &size, e - p + 1, 1)) {
+			c->err = errno;
+			break;
+		}
+		memcpy(buf, p, e - p);
+		buf[e - p] = '\0';
+		if (parseline(c, btm, buf, p - c->map)) {
+			c->err = errno;
+			break;
+		}
+	}
+	free(buf);
+	btm_del(btm);
+	return NULL;
+}
+
+struct specs *
+specsopen(int fd, int nthread)
+{
+	struct specs *sp;
+	struct chunk *c = NULL;
+	struct stat st;
+	const char *p;
+	size_t ninstr, nbits;
+	long n, line, i;
+	int k, err;
+
+	if (fstat(fd, &st))
+		return NULL;
+	if (!(sp = calloc(1, sizeof(*sp))))
+		return NULL;
+	if (!st.st_size)
+		return sp;
+	sp->mapsize = st.st_size;
+	sp->map = mmap(NULL, sp->mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (sp->map == MAP_FAILED) {
+		free(sp);
+		return NULL;
+	}
+	posix_madvise((void *)sp->map, sp->mapsize, POSIX_MADV_SEQUENTIAL);
+	if (nthread > sp->mapsize / MINCHUNK + 1)
+		nthread = sp->mapsize / MINCHUNK + 1;
+	if (nthread < 1)
+		nthread = 1;
+	if (!(c = calloc(nthread, sizeof(*c))))
+		goto fail;
+	p = sp->map;
+	for (k = 0; k < nthread; ++k) {
+		c[k].map = sp->map;
+		c[k].start = p;
+		p = sp->map + sp->mapsize * (k + 1) / nthread;
+		if (p < c[k].start)
+			p = c[k].start;
+		while (p < sp->map + sp->mapsize && p > sp->map && p[-1] != '\n')
+			++p;
+		c[k].end = p;
+	}
+	for (k = 1; k < nthread; ++k)
+		if ((err = pthread_create(&c[k].tid, NULL, parse, &c[k])))
+			break;
+	if (k == nthread)
+		parse(&c[0]);
+	for (i = 1; i < k; ++i)
+		pthread_join(c[i].tid, NULL);
+	if (k < nthread) {
+		errno = err;
+		nthread = k;
+		goto fail;
+	}
+	n = ninstr = nbits = 0;
+	err = 0;
+	for (k = 0; k < nthread; ++k) {
+		n += c[k].n;
+		ninstr += c[k].ninstr;
+		nbits += c[k].nbits;
+		if (!err)
+			err = c[k].err;
+	}
+	if (err) {
+		errno = err;
+		goto fail;
+	}
+	if (!(sp->spec = malloc((n ? n : 1) * sizeof(*sp->spec)))
+	|| !(sp->instrs = malloc((ninstr ? ninstr : 1) * sizeof(*sp->instrs)))
+	|| !(sp->bits = malloc(nbits ? nbits : 1)))
+		goto fail;
+	n = ninstr = nbits = 0;
+	line = 0;
+	for (k = 0; k < nthread; ++k) {
+		for (i = 0; i < c[k].n; ++i) {
+			sp->spec[n] = c[k].spec[i];
+			sp->spec[n].line += line;
+			sp->spec[n].instr += ninstr;
+			sp->spec[n].bits += nbits;
+			++n;
+		}
+		memcpy(sp->instrs + ninstr, c[k].instrs, c[k].ninstr * sizeof(*sp->instrs));
+		memcpy(sp->bits + nbits, c[k].bits, c[k].nbits);
+		ninstr += c[k].ninstr;
+		nbits += c[k].nbits;
+		line += c[k].nline;
+		free(c[k].spec);
+		free(c[k].instrs);
+		free(c[k].bits);
+	}
+	sp->n = n;
+	free(c);
+	return sp;
+fail:
+	err = errno;
+	for (k = 0; c && k < nthread; ++k) {
+		free(c[k].spec);
+		free(c[k].instrs);
+		free(c[k].bits);
+	}
+	free(c);
+	specsclose(sp);
+	errno = err;
+	return NULL;
+}
+
+void
+specsclose(struct specs *sp)
+{
+	if (!sp)
+		return;
+	if (sp->mapsize)
+		munmap((void *)sp->map, sp->mapsize);
+	free(sp->spec);
+	free(sp->instrs);
+	free(sp->bits);
+	free(sp);
+}
+
+int
+specsload(const struct specs *sp, long i, BTM *btm)
+{
+	const struct spec *s = &sp->spec[i];
+
+	if (!s->size) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (btm_table_set(btm, s->size, sp->instrs + s->instr))
+		return -1;
+	btm_reset(btm);
+	if (s->conf && (btm_set_bits(btm, s->start, s->end, sp->bits + s->bits)
+	|| btm_set_state(btm, s->state)))
+		return -1;
+	return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef SPECS_H_
+#define SPECS_H_
+
+#include <stddef.h>
+
+#include "btm.h"
+
+/*
+ * a file of BTM specs, mapped into memory and parsed by several threads
+ * at once into flat arrays.  every non-blank line is an instruction
+ * table, optionally followed by a comma and a configuration, and may be
+ * prefixed by "TABLE continues after N steps: " as btm-emul -c writes
+ * it.
+ */
+struct spec {
+	long line;          /* line number in the file */
+	long long nstep;    /* N of the prefix above, or -1 without one */
+	size_t text;        /* offset of the instruction table in the file */
+	int textlen;
+	int size;           /* number of states, 0 if the line is invalid */
+	size_t instr;       /* offset of the size * 2 instructions in @instrs */
+	int conf;           /* whether there's a configuration */
+	int state;
+	int start;          /* tape range of the configuration */
+	int end;
+	size_t bits;        /* offset of its cells, as by btm_get_bits() */
+};
+
+struct specs {
+	const char *map;
+	size_t mapsize;
+	long n;
+	struct spec *spec;
+	int *instrs;
+	unsigned char *bits;
+};
+
+/*
+ * maps the regular file open on @fd and parses it with up to @nthread
+ * threads.  invalid lines are kept as specs of size 0 so they can be
+ * reported by line number.  returns NULL and sets errno on failure.
+ */
+struct specs *specsopen(int fd, int nthread);
+
+void specsclose(struct specs *sp);
+
+/*
+ * sets @btm's instruction table and configuration to those of the
+ * @i-th specs, resetting it first.  returns 0 on success, non-zero
+ * value and sets errno if the specs are invalid or memory allocation
+ * fails.
+ */
+int specsload(const struct specs *sp, long i, BTM *btm);
+
+#endif
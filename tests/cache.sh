@@ -0,0 +1,34 @@
+#!/bin/bash
+# btm-enum must output the same with a cache as without, whether it's
+# cold, warm, too small or shared by two runs at once, and a run that
+# has the cache to itself must empty the entries left odd (being
+# written) by a writer that died.
+
+set -e
+
+d=$(mktemp -d)
+trap 'rm -rf "$d"' EXIT
+
+args='-mfu -z 4,8 -t 50,1000 -p I1o0'
+./btm-enum $args 4 > "$d/want"
+test -s "$d/want"
+for c in c,4096 c s,16; do
+	./btm-enum $args -C "$d/$c" 4 | cmp -s - "$d/want"
+done
+./btm-enum $args -C "$d/t,4096" 4 > "$d/out1" &
+./btm-enum $args -C "$d/t,4096" 4 > "$d/out2"
+wait $!
+cmp -s "$d/out1" "$d/want"
+cmp -s "$d/out2" "$d/want"
+
+# the header and the entries are 64 bytes each, an entry starting with
+# its 32-bit sequence number
+odd() {
+	od -A n -t u4 -w64 -v "$d/c" | awk 'NR > 1 && $1 % 2' | wc -l
+}
+for i in $(seq 0 63); do
+	printf '\1' | dd of="$d/c" bs=1 seek=$((64 + i * 64)) conv=notrunc 2> /dev/null
+done
+test "$(odd)" -eq 64
+./btm-enum $args -C "$d/c" 4 | cmp -s - "$d/want"
+test "$(odd)" -eq 0
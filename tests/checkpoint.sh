@@ -0,0 +1,27 @@
+#!/bin/bash
+# an enumeration stopped with SIGTERM and resumed from its checkpoint
+# must output what an uninterrupted one does, and resuming a finished
+# one, exhaustive or random, must output nothing.
+
+set -e
+
+d=$(mktemp -d)
+trap 'rm -rf "$d"' EXIT
+
+opts='-mfu -t 20,30 -p I1 4'
+./btm-enum $opts | sort > "$d/full"
+./btm-enum -k "$d/ck" $opts > "$d/out" &
+sleep 1
+kill $! 2> /dev/null || true
+wait $! || true
+timeout 60 ./btm-enum -k "$d/ck" $opts >> "$d/out"
+sort "$d/out" | cmp -s - "$d/full"
+test -z "$(timeout 10 ./btm-enum -k "$d/ck" $opts)"
+
+./btm-enum -k "$d/rck,100" -r 100000 4 > "$d/rout" &
+sleep 0.5
+kill $! 2> /dev/null || true
+wait $! || true
+timeout 60 ./btm-enum -k "$d/rck,100" -r 100000 4 >> "$d/rout"
+test "$(wc -l < "$d/rout")" -eq 100000
+test -z "$(timeout 10 ./btm-enum -k "$d/rck,100" -r 100000 4)"
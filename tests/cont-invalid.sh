@@ -0,0 +1,13 @@
+#!/bin/bash
+# btm-emul -i -u must settle a holdout whose line can't be parsed and
+# keep the line as it is, rather than scheduling it again forever.
+
+set -e
+
+f=$(mktemp)
+trap 'rm -f "$f"' EXIT
+
+printf 'step count: 0\nIi1If\nIx9zz\nIi0Io1\n' > "$f"
+timeout 60 ./btm-emul -i -n 1000 -u "$f" > /dev/null 2>&1
+grep -qx 'Ix9zz' "$f"
+grep -qx 'Ii1If never finishes (translated cycler)' "$f"
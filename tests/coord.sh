@@ -0,0 +1,49 @@
+#!/bin/bash
+# a btm-coord campaign must output what btm-enum does for every shard
+# and end with every worker exiting successfully.  it must resume from
+# a journal whose last line was cut off and refuse to overwrite output
+# it has no journal for.
+
+set -e
+
+d=$(mktemp -d)
+trap 'rm -rf "$d"' EXIT
+
+args='-mfu -t 10,20 3'
+./btm-enum -mfu -l 2 3 > "$d/shards"
+while read -r p; do
+	./btm-enum -p "$p" $args
+done < "$d/shards" | sort > "$d/want"
+
+campaign() {
+	timeout 60 ./btm-coord "$d/journal" "$d/out" "$d/sock" -- $args < "$d/shards" &
+	c=$!
+	for i in $(seq 100); do
+		[ -S "$d/sock" ] && break
+		sleep 0.1
+	done
+	timeout 60 ./btm-work "$d/sock" &
+	w1=$!
+	timeout 60 ./btm-work "$d/sock" &
+	w2=$!
+	wait $c
+	wait $w1
+	wait $w2
+	sort "$d/out" | cmp -s - "$d/want"
+}
+
+campaign
+
+# the journal has the args line and a line per shard
+head -n 4 "$d/journal" > "$d/cut"
+sed -n 5p "$d/journal" | head -c 5 >> "$d/cut"
+mv "$d/cut" "$d/journal"
+campaign
+test "$(wc -l < "$d/journal")" -eq "$(($(wc -l < "$d/shards") + 1))"
+
+rm "$d/journal"
+cp "$d/out" "$d/saved"
+if timeout 10 ./btm-coord "$d/journal" "$d/out" "$d/sock" -- $args < "$d/shards" 2> /dev/null; then
+	exit 1
+fi
+cmp -s "$d/out" "$d/saved"
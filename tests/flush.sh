@@ -0,0 +1,14 @@
+#!/bin/bash
+# sparse output must reach stdout within a few seconds, before the
+# program is killed, not only when the next record is written.
+
+set -e
+
+f=$(mktemp)
+trap 'rm -f "$f"' EXIT
+
+./btm-emul -s -n 0 foff O1fo0f > "$f" &
+sleep 3
+kill -9 $!
+wait $! 2> /dev/null || true
+grep -qx 'foff finished in 1 steps' "$f"
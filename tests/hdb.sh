@@ -0,0 +1,26 @@
+#!/bin/bash
+# btm-hdb must advance the holdouts of a state file the way btm-emul -u
+# does: import, two threaded rounds and export must print the same
+# finished BTMs and leave the same state, which re-imports unchanged.
+
+set -e
+
+d=$(mktemp -d)
+trap 'rm -rf "$d"' EXIT
+
+{
+	echo 'step count: 0'
+	./btm-enum -mfu -t 10 3 | awk 'NR % 50 == 0'
+} > "$d/state"
+cp "$d/state" "$d/text"
+./btm-hdb -i "$d/db" < "$d/state"
+for n in 20 30; do
+	./btm-emul -n $n -u "$d/text" | sort >> "$d/want"
+	./btm-hdb -j 2 -n $n "$d/db" | sort >> "$d/got"
+done
+test -s "$d/want"
+cmp -s "$d/want" "$d/got"
+./btm-hdb -e "$d/db" > "$d/state"
+cmp -s "$d/state" "$d/text"
+./btm-hdb -i "$d/db2" < "$d/state"
+./btm-hdb -e "$d/db2" | cmp -s - "$d/state"
@@ -0,0 +1,53 @@
+#!/bin/bash
+# the iterator's per-flag-set fill and increment steps must produce the
+# BTMs the generic ones did before them.  every line below has btm-enum
+# arguments, a tab and the cksum of their output, as recorded with the
+# generic iterator.
+
+set -e
+
+while IFS='	' read -r args sum; do
+	if [ "$(./btm-enum $args | cksum)" != "$sum" ]; then
+		echo "btm-enum $args: output changed" >&2
+		exit 1
+	fi
+done <<'END'
+3	3640819647 12717120
+-m 3	2354820975 6625008
+-c 3	2516117515 100800
+-mc 3	3198633153 58800
+-e 3	4022646402 1869668
+-me 3	97228565 972016
+-f 3	2477506372 3759168
+-mf 3	3494682846 2146032
+-u 3	541255136 12244992
+-mu 3	2716040380 6332928
+-ce 3	2910339915 20580
+-mce 3	870776137 11760
+-cf 3	3216648145 72128
+-mcf 3	2035912552 44464
+-cu 3	2040459496 71680
+-mcu 3	314472409 39424
+-ef 3	4087684774 749924
+-mef 3	2333776139 412144
+-eu 3	2259922867 1736064
+-meu 3	3770380753 894336
+-fu 3	1692350488 3287040
+-mfu 3	309948631 1853952
+-cef 3	1520867115 16996
+-mcef 3	809243480 9968
+-ceu 3	1574412722 11648
+-mceu 3	2869726944 6272
+-cfu 3	776292655 43008
+-mcfu 3	673297596 25088
+-efu 3	2762551436 616320
+-mefu 3	2995230078 334464
+-cefu 3	3704467338 8064
+-mcefu 3	1761057065 4480
+-l 3 3	966949633 4944
+-fu -l 4 4	2746734390 70784
+-ce -l 5 4	3187610455 5880
+-mfu -p I1o0 -t 10,60 4	1735408491 99319
+-mfue -t 5,40 4	3087177227 8883432
+-mfuc -t 5,40 4	3553282530 81162
+END
@@ -0,0 +1,54 @@
+#include <stdio.h>
+
+#include "btm.h"
+#include "util.h"
+
+/*
+ * checks btm_iter_count() against the number of instruction tables (or
+ * prefixes) the iterator visits, for every set of non-random flags.
+ */
+static const struct {
+	int size;
+	const char *prefix;
+	int len;
+} cases[] = {
+	{ 1, NULL, -1 },
+	{ 2, NULL, -1 },
+	{ 3, NULL, -1 },
+	{ 3, "I1", -1 },
+	{ 3, "f", -1 },
+	{ 3, NULL, 3 },
+	{ 4, NULL, 4 },
+	{ 4, "I1i1", -1 },
+	{ 4, "O1i1I2", 7 },
+	{ 5, NULL, 3 },
+};
+
+int
+main(int argc, char **argv)
+{
+	BTMIter *it;
+	double want, n;
+	int i, flags, bad;
+
+	progname = argv[0];
+	bad = 0;
+	for (i = 0; i < sizeof(cases) / sizeof(*cases); ++i) {
+		for (flags = 0; flags < 32; flags += 2) {
+			if (!(it = btm_iter_new(cases[i].size, flags, cases[i].prefix, cases[i].len)))
+				die("btm_iter_new:");
+			if ((want = btm_iter_count(it)) < 0)
+				die("btm_iter_count:");
+			for (n = 0; btm_iter_deref(it); btm_iter_incr(it))
+				++n;
+			btm_iter_del(it);
+			if (n != want) {
+				warn("size %d, prefix %s, len %d, flags %d: %.0f counted, %.0f visited",
+				cases[i].size, cases[i].prefix ? cases[i].prefix : "none",
+				cases[i].len, flags, want, n);
+				bad = 1;
+			}
+		}
+	}
+	return bad;
+}
@@ -0,0 +1,5 @@
+#!/bin/bash
+# btm_iter_count() must agree with the number of BTMs the iterator
+# visits (see itercount.c).
+
+exec tests/itercount
@@ -0,0 +1,6 @@
+#!/bin/bash
+# btm-enum -w mult,secs must stop mining after SECS seconds.
+
+set -e
+
+timeout 30 ./btm-enum -w 2,2 -t 10 -mfu 4 > /dev/null
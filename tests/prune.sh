@@ -0,0 +1,15 @@
+#!/bin/bash
+# the prefixes btm-enum -P leaves must still cover every BTM that the
+# enumeration outputs, with and without -m.
+
+set -e
+
+f=$(mktemp)
+trap 'rm -f "$f"' EXIT
+
+for m in -m ''; do
+	./btm-enum $m -fu -t 10,20 3 | sort > "$f"
+	./btm-enum $m -fu -P -t 10 -l 2 3 | while read -r p; do
+		./btm-enum $m -fu -p "$p" -t 10,20 3
+	done | sort | cmp -s - "$f"
+done
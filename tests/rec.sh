@@ -0,0 +1,28 @@
+#!/bin/bash
+# binary records must carry step counts up to 2^62 - 1 through btm-conv
+# unchanged, and larger counts and overlong varints must be rejected.
+
+set -e
+
+d=$(mktemp -d)
+trap 'rm -rf "$d"' EXIT
+
+for n in 0 1 31 32 8191 2147483648 2305843009213693951 \
+	2305843009213693952 4611686018427387903; do
+	printf 'IiIf\t%s\nIi0Io1 finished in %s steps\nfoff continues after %s steps\n' \
+		$n $n $n
+done > "$d/text"
+./btm-conv < "$d/text" | ./btm-conv -t > "$d/back"
+cmp -s "$d/text" "$d/back"
+
+for n in 4611686018427387904 9223372036854775807; do
+	if printf 'IiIf\t%s\n' $n | ./btm-conv > /dev/null 2>&1; then
+		exit 1
+	fi
+done
+
+# size 1, one instruction (FIN), then a varint with an 11th byte
+printf '\1\1\4\377\377\377\377\377\377\377\377\377\200\0' > "$d/long"
+if ./btm-conv -t < "$d/long" > /dev/null 2>&1; then
+	exit 1
+fi
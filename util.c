@@ -3,11 +3,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "util.h"
 
+#define OUT_BUF_SZ  (1 << 20)
+#define OUT_PERIOD  1
+
 const char *progname;
 
+static time_t outflushed;
+
 void
 vwarn(const char *fmt, va_list ap)
 {
@@ -82,3 +88,31 @@ xatoll(const char *str)
 		die("%s: Trailing characters: `%s'", str, ep);
 	return ll;
 }
+
+/*
+ * makes stdout fully buffered with a large buffer.  the programs flush
+ * it at exit, including exit upon SIGTERM/SIGINT, and call outtick()
+ * after every record and wherever they may spend a while between
+ * records, so that output doesn't lag by much more than OUT_PERIOD
+ * seconds even when it's sparse.  the deadline is checked against
+ * time() rather than kept with a timer, leaving SIGALRM to the programs.
+ */
+void
+outinit(void)
+{
+	if (setvbuf(stdout, NULL, _IOFBF, OUT_BUF_SZ))
+		die("setvbuf:");
+	outflushed = time(NULL);
+}
+
+void
+outtick(void)
+{
+	time_t t;
+
+	if ((t = time(NULL)) - outflushed < OUT_PERIOD)
+		return;
+	if (fflush(stdout))
+		die("fflush:");
+	outflushed = t;
+}
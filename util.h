@@ -11,6 +11,8 @@ void warn(const char *fmt, ...);
 void die(const char *fmt, ...);
 int xatoi(const char *str);
 long long xatoll(const char *str);
+void outinit(void);
+void outtick(void);
 
 extern const char *progname;
 